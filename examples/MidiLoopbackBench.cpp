@@ -0,0 +1,188 @@
+//
+//  MidiLoopbackBench.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Measures the throughput and latency of LabMidi's input paths, fed by a
+// MidiLoopbackOut, so that no MIDI hardware or OS MIDI service is needed.
+//
+// usage: LabMidiLoopbackBench [messages]
+
+#include "LabMidi/MidiFile.h"
+#include "LabMidi/MidiFilePlayer.h"
+#include "LabMidi/MidiInOut.h"
+#include "LabMidi/Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+    std::atomic<uint64_t> received(0);
+
+    void countMessage(void*, const Lab::MidiInMessage*)
+    {
+        received.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void report(const char* name, size_t messages, int64_t elapsed)
+    {
+        if (elapsed < 1)
+            elapsed = 1;
+        printf("%-28s %10.1f ns/message %14.0f messages/s\n", name,
+               double(elapsed) / double(messages),
+               double(messages) * 1.0e9 / double(elapsed));
+    }
+
+    // Each message carries its index, so that the consumer can look up
+    // when it was sent. Latency is from the send call to the consumer
+    // holding the message.
+    //
+    void latency(size_t messages)
+    {
+        Lab::MidiIn in;
+        in.enableQueue(4096);
+        Lab::MidiLoopbackOut out(&in);
+
+        std::vector<int64_t> sent(messages);
+        std::vector<int64_t> latencies;
+        latencies.reserve(messages);
+
+        std::thread consumer([&]() {
+            Lab::MidiInMessage msg;
+            while (latencies.size() < messages && in.wait(msg, 1000000000)) {
+                size_t i = size_t(msg.data[1]) | (size_t(msg.data[2]) << 7);
+                int64_t now = Lab::monotonicNanoseconds();
+                latencies.push_back(now - sent[i % messages]);
+            }
+        });
+
+        // paced well below the consumer's rate, so that the latency is the
+        // path's and not the queue's backlog
+        for (size_t i = 0; i < messages; ++i) {
+            uint8_t data[3] = { MIDI_NOTE_ON, uint8_t(i & 0x7f), uint8_t((i >> 7) & 0x7f) };
+            sent[i] = Lab::monotonicNanoseconds();
+            out.send(data, 3);
+            Lab::sleepUntilNanoseconds(sent[i] + 100000);
+        }
+        consumer.join();
+
+        if (latencies.empty())
+            return;
+        std::sort(latencies.begin(), latencies.end());
+        printf("%-28s p50 %lld ns, p99 %lld ns, max %lld ns, over %zu messages\n", "queue, wait latency",
+               (long long) latencies[latencies.size() / 2],
+               (long long) latencies[latencies.size() * 99 / 100],
+               (long long) latencies.back(), latencies.size());
+    }
+
+} // anon
+
+int main(int argc, char** argv)
+{
+    size_t messages = argc > 1 ? size_t(strtoull(argv[1], 0, 10)) : 1000000;
+    if (!messages)
+        messages = 1;
+
+    // messages delivered to a callback on the sending thread
+    {
+        Lab::MidiIn in;
+        in.addMessageCallback(countMessage, nullptr);
+        Lab::MidiLoopbackOut out(&in);
+        received = 0;
+        int64_t start = Lab::monotonicNanoseconds();
+        for (size_t i = 0; i < messages; ++i) {
+            Lab::MidiCommand mc(uint8_t(MIDI_NOTE_ON | (i & 0xf)), uint8_t(i & 0x7f), 100);
+            out.command(&mc);
+        }
+        report("callback", messages, Lab::monotonicNanoseconds() - start);
+    }
+
+    // messages queued on the sending thread, and drained on another. The
+    // sender stays within the queue's capacity, so nothing overflows.
+    {
+        Lab::MidiIn in;
+        in.enableQueue(4096);
+        Lab::MidiLoopbackOut out(&in);
+        std::atomic<size_t> drained(0);
+        int64_t start = Lab::monotonicNanoseconds();
+        std::thread consumer([&]() {
+            Lab::MidiInMessage batch[256];
+            while (drained.load() < messages) {
+                size_t n = in.drain(batch, 256);
+                if (n)
+                    drained.fetch_add(n);
+                else
+                    std::this_thread::yield();
+            }
+        });
+        for (size_t i = 0; i < messages; ++i) {
+            while (i - drained.load(std::memory_order_relaxed) >= 2048)
+                std::this_thread::yield();
+            uint8_t data[3] = { uint8_t(MIDI_CONTROL_CHANGE | (i & 0xf)), 7, uint8_t(i & 0x7f) };
+            out.send(data, 3);
+        }
+        consumer.join();
+        report("queue, drain", messages, Lab::monotonicNanoseconds() - start);
+    }
+
+    // SysEx copied through the queue's spill ring, and read back
+    {
+        Lab::MidiIn in;
+        in.enableQueue(1024, 1 << 16);
+        Lab::MidiLoopbackOut out(&in);
+        std::vector<uint8_t> sysex(4096, 0x55);
+        sysex.front() = MIDI_SYSTEM_EXCLUSIVE;
+        sysex.back() = MIDI_EOX;
+        size_t count = std::max(size_t(1), messages / 100);
+        size_t bytes = 0;
+        Lab::MidiInMessage msg;
+        int64_t start = Lab::monotonicNanoseconds();
+        for (size_t i = 0; i < count; ++i) {
+            out.send(sysex.data(), sysex.size());
+            if (in.read(msg))
+                bytes += msg.size;
+        }
+        int64_t elapsed = std::max(int64_t(1), Lab::monotonicNanoseconds() - start);
+        printf("%-28s %10.1f MB/s\n", "queue, 4KB SysEx",
+               double(bytes) * 1.0e3 / double(elapsed));
+    }
+
+    // a song rendered as fast as possible, from player to input
+    {
+        Lab::MidiIn in;
+        in.addMessageCallback(countMessage, nullptr);
+        Lab::MidiLoopbackOut out(&in);
+        Lab::MidiSong song;
+        for (int i = 0; i < 16; ++i) {
+            std::shared_ptr<Lab::MidiTrack> track = std::make_shared<Lab::MidiTrack>();
+            for (int j = 0; j < 4096; ++j) {
+                Lab::Event_Channel* ev = new Lab::Event_Channel();
+                ev->tick = 10;
+                ev->data = { uint8_t(((j & 1) ? MIDI_NOTE_OFF : MIDI_NOTE_ON) | i), uint8_t(36 + (j >> 1) % 48), 100 };
+                track->events.push_back(ev);
+            }
+            track->events.push_back(new Lab::Event_EndOfTrack());
+            song.tracks.push_back(track);
+        }
+        Lab::MidiSongPlayer player(&song);
+        player.addSink(&out);
+        received = 0;
+        player.play(0);
+        int64_t start = Lab::monotonicNanoseconds();
+        player.freewheelNs();
+        int64_t elapsed = Lab::monotonicNanoseconds() - start;
+        report("player, freewheel", size_t(std::max(uint64_t(1), received.load())), elapsed);
+    }
+
+    latency(std::min(messages, size_t(10000)));
+    return 0;
+}
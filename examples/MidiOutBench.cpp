@@ -0,0 +1,102 @@
+//
+//  MidiOutBench.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Measures the cost of MidiOut's send path, against a null port, so that
+// the time reported is LabMidi's own, and not a driver's.
+//
+// usage: LabMidiOutBench [messages]
+
+#include "LabMidi/MidiInOut.h"
+#include "LabMidi/Util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace {
+
+    volatile size_t sunk = 0;
+
+    template <typename Fn>
+    void bench(const char* name, size_t messages, Fn fn)
+    {
+        int64_t start = Lab::monotonicNanoseconds();
+        fn();
+        int64_t elapsed = Lab::monotonicNanoseconds() - start;
+        if (elapsed < 1)
+            elapsed = 1;
+        printf("%-20s %10.1f ns/message %14.0f messages/s\n", name,
+               double(elapsed) / double(messages),
+               double(messages) * 1.0e9 / double(elapsed));
+    }
+
+} // anon
+
+int main(int argc, char** argv)
+{
+    size_t messages = argc > 1 ? size_t(strtoull(argv[1], 0, 10)) : 10000000;
+    if (!messages)
+        messages = 1;
+
+    Lab::MidiOut out;
+    out.openNullPort();
+
+    // the way messages used to be built, for comparison
+    bench("vector per message", messages, [&]() {
+        for (size_t i = 0; i < messages; ++i) {
+            std::vector<unsigned char> message;
+            message.push_back(MIDI_NOTE_ON | int(i & 0xf));
+            message.push_back((unsigned char) (i & 0x7f));
+            message.push_back(100);
+            sunk = sunk + message.size();
+        }
+    });
+
+    bench("sendNoteOn", messages, [&]() {
+        for (size_t i = 0; i < messages; ++i)
+            out.sendNoteOn(int(i & 0xf), int(i & 0x7f), 100);
+    });
+
+    bench("sendControlChange", messages, [&]() {
+        for (size_t i = 0; i < messages; ++i)
+            out.sendControlChange(int(i & 0xf), 7, int(i & 0x7f));
+    });
+
+    bench("sendProgramChange", messages, [&]() {
+        for (size_t i = 0; i < messages; ++i)
+            out.sendProgramChange(int(i & 0xf), int(i & 0x7f));
+    });
+
+    bench("command", messages, [&]() {
+        Lab::MidiCommand mc(MIDI_NOTE_ON, 60, 100);
+        for (size_t i = 0; i < messages; ++i) {
+            mc.byte1 = uint8_t(i & 0x7f);
+            out.command(&mc);
+        }
+    });
+
+    std::vector<Lab::MidiCommand> chord;
+    for (int i = 0; i < 128; ++i)
+        chord.push_back(Lab::MidiCommand(MIDI_NOTE_ON, uint8_t(i), 100));
+    size_t chords = (messages + chord.size() - 1) / chord.size();
+    bench("send, 128 a chord", chords * chord.size(), [&]() {
+        for (size_t i = 0; i < chords; ++i)
+            out.send(chord.data(), chord.size());
+    });
+
+    std::vector<Lab::MidiRtEvent> batch;
+    for (int i = 0; i < 256; ++i)
+        batch.push_back(Lab::MidiRtEvent(0, MIDI_NOTE_ON, uint8_t(i & 0x7f), 100));
+    size_t batches = (messages + batch.size() - 1) / batch.size();
+    bench("events, 256 a batch", batches * batch.size(), [&]() {
+        for (size_t i = 0; i < batches; ++i)
+            out.events(batch.data(), batch.size());
+    });
+
+    return 0;
+}
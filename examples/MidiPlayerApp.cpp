@@ -77,46 +77,10 @@ MidiPlayerApp::~MidiPlayerApp
     delete _detail;
 }
 
-double MidiPlayerApp::getElapsedSeconds()
-{
-#ifdef _MSC_VER
-    static double freq;
-    static LARGE_INTEGER start;
-    static bool init = true;
-    if (init) {
-        LARGE_INTEGER lFreq;
-        QueryPerformanceFrequency(&lFreq);
-        freq = double(lFreq.QuadPart);
-        QueryPerformanceCounter(&start);
-        init = false;
-    }
-    LARGE_INTEGER now;
-    QueryPerformanceCounter(&now);
-    return double(now.QuadPart - start.QuadPart) / freq;
-#else
-    timeval t;
-    gettimeofday(&t, 0);
-    return double(t.tv_sec) + double(t.tv_usec) * 1.0e-6f;
-#endif
-}
-
 void MidiPlayerApp::setup()
 {
 }
 
-void MidiPlayerApp::update(double t)
-{
-    _detail->midiSongPlayer->update(static_cast<float>(t));
-}
-
-bool MidiPlayerApp::running(double t)
-{
-    if (!_detail->midiSongPlayer)
-        return false;
-
-    return t <= (_detail->midiSongPlayer->length() + 0.5f);
-}
-
 int main(int argc, char** argv)
 {
     MidiPlayerApp app;
@@ -136,18 +100,23 @@ int main(int argc, char** argv)
             midiSong->parse(path.c_str(), true);
             app._detail->midiSongPlayer = new Lab::MidiSongPlayer(midiSong);
             app._detail->midiSongPlayer->addCallback(Lab::MidiOut::playerCallback, midiOut);
-            app._detail->midiSongPlayer->play(0);
 
-            double startTime = app.getElapsedSeconds();
-
-            while (app.running(app.getElapsedSeconds() - startTime)) {
+            // The player thread sleeps until each event is due, so the main
+            // thread only needs to check in occasionally.
+            Lab::MidiPlayerThread playerThread(app._detail->midiSongPlayer);
+            playerThread.start();
+            while (playerThread.running()) {
                 #ifdef _MSC_VER
-                Sleep(1); // 1ms delay --- to do - shouldn't sleep this long
+                Sleep(100);
                 #else
-                usleep(100); // 0.1ms delay
+                usleep(100000);
                 #endif
-                app.update(app.getElapsedSeconds() - startTime);
             }
+
+            Lab::MidiPlayerThreadStats stats = playerThread.stats();
+            std::cout << "Dispatched " << stats.dispatches << " times in " << stats.wakeups << " wakeups, "
+                      << "mean lateness " << stats.meanLatenessNs / 1000 << "us, "
+                      << "max lateness " << stats.maxLatenessNs / 1000 << "us" << std::endl;
             delete midiOut;
         }
     }
@@ -41,10 +41,6 @@ public:
     ~MidiPlayerApp();
     
 	void setup();
-	void update(double t);
-    
-    double getElapsedSeconds();
-    bool running(double t);
     
     //private:
     class Detail;
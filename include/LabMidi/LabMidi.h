@@ -9,7 +9,11 @@
 #include "LabMidi/MidiInOut.h"
 #include "LabMidi/MidiFile.h"
 #include "LabMidi/MidiFilePlayer.h"
+#include "LabMidi/PlayerThread.h"
 #include "LabMidi/Ports.h"
+#include "LabMidi/Recorder.h"
+#include "LabMidi/Router.h"
+#include "LabMidi/Scheduler.h"
 #include "LabMidi/SoftSynth.h"
 #include "LabMidi/Util.h"
 
@@ -109,13 +109,14 @@ namespace Lab {
     struct Event_SmpteOffset : public MidiEvent {
         Event_SmpteOffset() : MidiEvent(Midi_MetaEventType::SMPTE_OFFSET) {} uint8_t framerate = 0; uint8_t hour = 0; uint8_t min = 0; uint8_t sec = 0; uint8_t frame = 0; uint8_t subframe = 0; };
     struct Event_TimeSignature : public MidiEvent {
-        Event_TimeSignature() : MidiEvent(Midi_MetaEventType::TIME_SIGNATURE) {}  double timeSignature = 120.; uint8_t metronome = 0; uint8_t thirtyseconds = 0; };
+        Event_TimeSignature() : MidiEvent(Midi_MetaEventType::TIME_SIGNATURE) {}  double timeSignature = 120.; uint8_t metronome = 0; uint8_t thirtyseconds = 0;
+        uint8_t numerator = 4; uint8_t denominator = 2; /* as a power of two */ };
     struct Event_KeySignature : public MidiEvent {
         Event_KeySignature() : MidiEvent(Midi_MetaEventType::KEY_SIGNATURE) {} uint8_t key = 0; uint8_t scale = 0; };
     struct Event_SequencerSpecific : public MidiEvent {
         Event_SequencerSpecific() : MidiEvent(Midi_MetaEventType::PROPRIETARY) {} };
     struct Event_Unknown : public MidiEvent {
-        Event_Unknown() : MidiEvent(Midi_MetaEventType::UNKNOWN) {} };
+        Event_Unknown() : MidiEvent(Midi_MetaEventType::UNKNOWN) {} uint8_t metaType = 0xff; };
     struct Event_SysEx : public MidiEvent {
         Event_SysEx() : MidiEvent(Midi_MetaEventType::SYSTEM_EXCLUSIVE) {} };
     struct Event_DividedSysEx : public MidiEvent {
@@ -142,6 +143,8 @@ namespace Lab {
         void parse(uint8_t const*const midifiledata, size_t length, bool verbose);
         void parse(char const*const midifilePath, bool verbose);
 
+        // Writes a Standard MIDI file, with a track chunk for each track
+        // and ticksPerBeat as the division
         void writeMidi(std::ostream& out);
 
         // Converts MML to Midi
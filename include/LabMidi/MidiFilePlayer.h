@@ -33,26 +33,217 @@
 
 #include "LabMidi/MidiInOut.h"
 
+#include <stddef.h>
+#include <stdint.h>
+
 namespace Lab {
 
     class MidiSong;
     
     struct MidiRtEvent;
     
+    enum class Midi_MetaEventType : uint8_t;
+    
     typedef void (*MidiEventCallbackFn)(void* userData, MidiRtEvent*);
     
+    // A meta event from a song, such as a marker, lyric, or cue point. For
+    // the text events, data holds the text, which is not null terminated.
+    // For the others, data holds the event's bytes as they appear in a
+    // file, such as the three byte tempo in microseconds per quarter note.
+    // The data is owned by the player and is valid for the player's
+    // lifetime.
+    //
+    struct MidiMetaEvent {
+        int64_t timeNs;         // song time in nanoseconds
+        Midi_MetaEventType type;
+        int track;
+        const uint8_t* data;
+        size_t size;
+        
+        float seconds() const { return float(double(timeNs) * 1.0e-9); }
+    };
+    
+    typedef void (*MidiMetaCallbackFn)(void* userData, const MidiMetaEvent*);
+    
+    // Dispatch timing recorded by an instrumented MidiSongPlayer. Lateness
+    // is how far past its due time an event was dispatched, as measured by
+    // the wall clock passed to update(). Sink time is the time spent in the
+    // sinks during one update.
+    //
+    struct MidiDispatchStats {
+        uint64_t updates = 0;           // updates that dispatched events
+        uint64_t events = 0;            // events dispatched
+        int64_t latenessP50Ns = 0;
+        int64_t latenessP99Ns = 0;
+        int64_t latenessP999Ns = 0;
+        int64_t latenessMaxNs = 0;
+        double eventsPerUpdateMean = 0;
+        int64_t eventsPerUpdateMax = 0;
+        int64_t sinkTimeP50Ns = 0;
+        int64_t sinkTimeP99Ns = 0;
+        int64_t sinkTimeMaxNs = 0;
+    };
+    
+    // Adapts a MidiEventCallbackFn to the MidiEventSink interface by
+    // invoking the callback once per event in the batch
+    //
+    class MidiCallbackSink : public MidiEventSink {
+    public:
+        MidiCallbackSink(MidiEventCallbackFn fn, void* userData)
+        : fn(fn), userData(userData) { }
+        
+        virtual void events(const MidiRtEvent* ev, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                fn(userData, const_cast<MidiRtEvent*>(&ev[i]));
+        }
+        
+        MidiEventCallbackFn fn;
+        void* userData;
+    };
+    
+    // MidiSongPlayer dispatches the events of a song to callbacks as
+    // update() is called with an advancing wall clock time.
+    //
+    // The player's timeline is kept in 64 bit integer nanoseconds, so that
+    // timing stays exact over multi-hour sessions. The functions ending in
+    // Ns take and return nanoseconds; the others are conveniences taking
+    // and returning seconds.
+    //
+    // The transport calls don't take effect immediately. They are posted
+    // to a wait-free queue that update() drains before dispatching, so
+    // they may be called from a control thread while another thread
+    // drives update(). Only one thread at a time may make these calls.
+    // They return false if the queue is full.
+    //
+    // Sinks and callbacks may be added or removed from any thread,
+    // including from within a sink or callback, and take effect at the
+    // next dispatch. Removal waits for any dispatch to it in progress on
+    // another thread, so once the remove call returns, the sink or
+    // callback won't be called again and may be freed.
+    //
+    // A new player is playing from wall clock time zero, as if play(0)
+    // had been called, so update() dispatches without a call to play().
+    //
+    // The player tracks which notes are sounding. Stopping, pausing,
+    // seeking, muting, or restarting sends the sinks a note off for
+    // each of them, so that no notes are left hanging.
+    //
     class MidiSongPlayer {
     public:
         MidiSongPlayer(MidiSong*);
         ~MidiSongPlayer();
         
-        void play(float wallClockTime);
+        // Start playing from the beginning of the song at wallClockTime
+        //
+        bool playNs(int64_t wallClockTime);
+        bool play(float wallClockTime);
+
+        // Stop playing, and rewind to the beginning of the song
+        //
+        bool stop();
+
+        // Pause holds the current position. Resume continues from it at
+        // the wall clock time of the update that applies the resume, and
+        // strikes again the notes that were sounding when paused.
+        //
+        bool pause();
+        bool resume();
+
+        // Continue playing from songTime into the song
+        //
+        bool seekNs(int64_t songTime);
+        bool seek(float songTime);
+
+        // Scale the rate of playback, 1 is normal speed
+        //
+        bool setSpeed(float speed);
+
+        // While muted, time advances but no events are dispatched
+        //
+        bool setMute(bool mute);
+
+        void updateNs(int64_t wallClockTime);
         void update(float wallClockTime);
         
-        float length() const; // length of the contained song
+        // Render from the current position as fast as possible, rather than
+        // in real time. A virtual wall clock jumps directly from one event
+        // time to the next, and sinks receive each group of simultaneous
+        // events in turn, stamped with their song times. Rendering stops
+        // at the end of the song, or at the first event after
+        // songTimeLimit. A paused player resumes; otherwise if the player
+        // isn't playing, it starts from the beginning of the song. Call
+        // from the thread driving update().
+        //
+        void freewheelNs(int64_t songTimeLimit = INT64_MAX);
+        void freewheel(float songTimeLimit);
+        
+        // length of the contained song
+        //
+        int64_t lengthNs() const;
+        float length() const;
+        
+        // The wall clock time at which the next channel or meta event is
+        // due. If the player is stopped or all events have been
+        // dispatched, returns the maximum int64_t value, or maximum float
+        // value. Call from the thread driving update().
+        //
+        int64_t nextEventTimeNs() const;
+        float nextEventTime() const;
+        bool atEnd() const;
+        
+        // Instrumentation records dispatch timing into histograms. It is
+        // off by default, and costs nothing until first enabled. The
+        // statistics may be read, reset, or written to a text file from
+        // any thread. writeDispatchStats returns false if the file could
+        // not be written.
+        //
+        void setInstrumented(bool);
+        MidiDispatchStats dispatchStats() const;
+        void resetDispatchStats();
+        bool writeDispatchStats(char const*const path) const;
+        
+        // Mute and solo take effect at once, without going through the
+        // command queue, and may be called from any thread. If any track
+        // or channel is soloed, only events on soloed tracks or channels
+        // are dispatched. Muted and unsoloed events are filtered out,
+        // except for the note offs of notes that are sounding. Tracks
+        // beyond the 64th share the last track's mute and solo.
+        //
+        void setTrackMute(int track, bool mute);
+        void setTrackSolo(int track, bool solo);
+        void setChannelMute(int channel, bool mute);
+        void setChannelSolo(int channel, bool solo);
+        
+        // The song's meta events, other than end of track markers, in time
+        // order. Meta events carry no sound, so they are delivered to the
+        // meta callback even while the player is muted. In an update, they
+        // are delivered before the channel events that are due. Only one
+        // meta callback may be set; passing null removes it.
+        //
+        size_t metaEventCount() const;
+        const MidiMetaEvent* metaEvents() const;
+        bool setMetaCallback(MidiMetaCallbackFn, void* userData);
+        
+        // The first meta event of a type, such as a marker, strictly after
+        // songTime, or null if there is none. O(log n).
+        //
+        const MidiMetaEvent* nextMetaEventNs(Midi_MetaEventType, int64_t songTime) const;
+        const MidiMetaEvent* nextMetaEvent(Midi_MetaEventType, float songTime) const;
+        
+        // The earliest meta event of a type whose text is name, or null if
+        // there is none. O(log n).
+        //
+        const MidiMetaEvent* findMetaEvent(Midi_MetaEventType, char const*const name) const;
         
-        void addCallback(MidiEventCallbackFn, void* userData);
-        void removeCallback(void* userData);
+        // Sinks receive all the events due in an update as a single batch.
+        // Callbacks are invoked once per event, via a MidiCallbackSink
+        // owned by the player.
+        //
+        bool addSink(MidiEventSink*);
+        bool removeSink(MidiEventSink*);
+        bool addCallback(MidiEventCallbackFn, void* userData);
+        bool removeCallback(void* userData);
         
     private:
         class Detail;
@@ -32,6 +32,8 @@
 
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
 #include <string>
 #include <vector>
 
@@ -111,27 +113,54 @@ struct MidiCommand {
 
 struct MidiRtEvent
 {
-    MidiRtEvent(float t, uint8_t b1, uint8_t b2, uint8_t b3)
-        : time(t)
+    MidiRtEvent() = default;
+    MidiRtEvent(int64_t timeNs, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t track = 0)
+        : timeNs(timeNs)
+        , track(track)
     {
         command.command = b1;
         command.byte1 = b2;
         command.byte2 = b3;
     }
 
-    MidiRtEvent& operator=(const MidiRtEvent& rhs)
-    {
-        time = rhs.time;
-        command = rhs.command;
-        return *this;
-    }
+    float seconds() const { return float(double(timeNs) * 1.0e-9); }
 
-    float time;
+    int64_t timeNs = 0; // nanoseconds
     MidiCommand command;
+    uint8_t track = 0;  // source track of a song event, clamped to 255
 };
 
 
 typedef void (*MidiCallbackFn)(void* userData, MidiCommand*);
+
+// A complete message received by a MidiIn, including SysEx. The bytes are
+// not owned by the message; see the MidiIn functions returning one for
+// how long they remain valid.
+//
+// timeNs is the sum of the MIDI backend's delta times since the port was
+// opened. arrivalNs is when the message reached LabMidi, on the clock read
+// by monotonicNanoseconds, so it can be compared with other timestamps
+// in the process, and used to measure latency.
+//
+struct MidiInMessage
+{
+    int64_t timeNs;
+    int64_t arrivalNs;
+    const uint8_t* data;
+    size_t size;
+};
+
+typedef void (*MidiMessageCallbackFn)(void* userData, const MidiInMessage*);
+
+// A MidiEventSink receives events in batches rather than one call per
+// event. For example, a MidiSongPlayer hands each sink all of the events
+// that fall due in an update with a single call.
+//
+class MidiEventSink {
+public:
+    virtual ~MidiEventSink() { }
+    virtual void events(const MidiRtEvent* events, size_t count) = 0;
+};
     
 //----------------------------------------------------------------------------
     
@@ -156,18 +185,144 @@ public:
     void closePort();
     unsigned int getPort() const;
         
+    // Callbacks, message callbacks, and sinks may be added and removed
+    // from any thread, including from within a callback. Removal waits
+    // for any message being delivered to it on another thread, so once
+    // the remove call returns, the callback or sink won't be called again
+    // and its userData may be freed.
+    //
+    // Callbacks receive the first three bytes of each message; SysEx is
+    // truncated
+    //
     void addCallback(MidiCallbackFn, void* userData);
     void removeCallback(void* userData);
+
+    // Message callbacks receive each message whole, including SysEx of
+    // any length. The bytes are only valid for the duration of the call.
+    //
+    void addMessageCallback(MidiMessageCallbackFn, void* userData);
+    void removeMessageCallback(void* userData);
+
+    // Sinks receive each incoming message as an event whose time is the
+    // time since the port was opened. Messages delivered as they arrive
+    // come one per call; dispatch hands each sink a batch of up to 64 at
+    // once, after the callbacks for them.
+    //
+    void addSink(MidiEventSink*);
+    void removeSink(MidiEventSink*);
+
+    // Normally callbacks and sinks are invoked on the MIDI backend's
+    // thread as messages arrive, so a slow consumer delays all input.
+    // Once the queue is enabled, the backend thread only copies each
+    // message into a wait-free queue, and a consumer thread takes them
+    // out with read or wait, or has dispatch invoke the callbacks and
+    // sinks for them. Enable the queue before opening a port.
+    //
+    // The capacity is in messages; SysEx longer than twelve bytes is
+    // stored separately, in sysexCapacity bytes, which must exceed the
+    // largest SysEx expected. Messages that don't fit are dropped, and
+    // counted as overflows.
+    //
+    void enableQueue(size_t capacity = 1024, size_t sysexCapacity = 65536);
+
+    // read returns false if no message is waiting. wait blocks for up to
+    // timeoutNs for a message to arrive, or indefinitely if timeoutNs is
+    // negative. The message's data remains valid until the next call to
+    // read, wait, drain, or dispatch. Only one thread may consume the queue.
+    //
+    bool read(MidiInMessage& msg);
+    bool wait(MidiInMessage& msg, int64_t timeoutNs);
+
+    // Polls for up to max messages at once, such as once per frame, and
+    // returns the number written to out. Their data remains valid until
+    // the next call to drain, read, wait, or dispatch. If the count of
+    // overflows has grown since the last call, input arrived faster than
+    // it was drained, and messages were lost.
+    //
+    size_t drain(MidiInMessage* out, size_t max);
+
+    // Invokes the callbacks and sinks for every queued message on the
+    // calling thread, and returns the number of messages dispatched.
+    //
+    size_t dispatch();
+
+    uint64_t queueOverflows() const;
+
+    // Coalescing thins out floods of control change, pitch bend, and
+    // pressure messages that have backed up in the queue. Among the
+    // messages taken by one call to drain, or by dispatch in batches of up
+    // to 64, a message is dropped when a later one for the same channel
+    // and controller arrived within windowNs of it, with no other message
+    // on the channel in between. Only values the consumer has fallen
+    // behind on are dropped. A message is never held back in case a later
+    // one replaces it, so coalescing adds no latency, and a consumer that
+    // keeps up receives every message. Messages delivered without the
+    // queue never back up, and are not coalesced. Notes, SysEx, bank
+    // select, data entry, RPN and NRPN, and channel mode messages are
+    // never dropped. A window of zero, the default, disables coalescing.
+    // The counts are of messages passed on, and dropped, by drain and
+    // dispatch.
+    //
+    void setCoalescing(int64_t windowNs);
+    uint64_t coalescedDelivered() const;
+    uint64_t coalescedDropped() const;
         
 private:
+    friend class MidiLoopbackOut;
     class Detail;
     Detail* _detail;
 };
 
-class MidiOutBase {
+class MidiOutBase : public MidiEventSink {
 public:
     virtual ~MidiOutBase() { }
     virtual void command(const MidiCommand*) = 0;
+
+    // The default implementation sends each event's command in turn
+    //
+    virtual void events(const MidiRtEvent* ev, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+            command(&ev[i].command);
+    }
+};
+
+// Pacing measured by a MidiOut. The delay of a message is the time from
+// when it was due to when the modelled wire was free to carry it. A
+// message sent while the output thread's schedule is full is dropped.
+//
+struct MidiOutPacingStats {
+    uint64_t messages = 0;      // number of messages paced
+    uint64_t delayed = 0;       // number of those that were delayed
+    uint64_t dropped = 0;       // number of messages that found no room
+    int64_t meanDelayNs = 0;    // over the delayed messages
+    int64_t maxDelayNs = 0;
+};
+
+// Progress of a MidiOut::sendSysEx, reported after each message
+//
+struct MidiSysExProgress {
+    size_t bytesSent = 0;       // how far through the buffer the send is
+    size_t totalBytes = 0;
+    size_t messagesSent = 0;
+    int64_t elapsedNs = 0;
+    double bytesPerSecond = 0;
+};
+
+// Return false to cancel the send
+typedef bool (*MidiSysExProgressFn)(void* userData, const MidiSysExProgress*);
+
+struct MidiSysExOptions {
+    // The least time between the starts of consecutive messages, for
+    // devices that need time to process each one
+    int64_t messageGapNs = 0;
+
+    // If not zero, consecutive messages are spaced so as not to exceed
+    // this rate, such as MidiOut::kDinBytesPerSecond
+    int bytesPerSecond = 0;
+
+    MidiSysExProgressFn progress = nullptr;
+    void* userData = nullptr;
 };
 
 class MidiOut : public MidiOutBase {
@@ -182,6 +337,20 @@ public:
     void closePort();
     unsigned int getPort() const;
 
+    // Opens a port that discards everything sent to it, for measuring
+    // the cost of sending, or for running without MIDI hardware. Opening
+    // a real port replaces it.
+    //
+    bool openNullPort();
+
+    // Opens a port whose messages arrive at a MidiIn in process, as those
+    // of a MidiLoopbackOut do, so that scheduling, pacing, and filtering
+    // can be exercised without MIDI hardware. Opening a real port, or the
+    // null port, replaces it.
+    //
+    bool openLoopbackPort(MidiIn*);
+
+    // Sending doesn't allocate; messages are built on the stack.
     // channels are 0-0xF (not 1-16)
     void sendNoteOn(int channel, int id, int value);
     void sendNoteOff(int channel, int id, int value);
@@ -191,7 +360,108 @@ public:
 
     virtual void command(const MidiCommand*);
 
-    // user data will be a MidiSoftSynth pointer
+    // Sends a batch of commands, such as a chord, in as few calls to the
+    // backend as it allows. On ALSA the batch is packed into one buffer,
+    // with running status; other backends take one message per call.
+    // events() sends its batch the same way.
+    //
+    void send(const MidiCommand*, size_t count);
+    virtual void events(const MidiRtEvent*, size_t count);
+
+    // Schedules a message to be sent at timeNs, on the monotonic clock
+    // of monotonicNanoseconds(). Scheduled messages are sent by an output
+    // thread, started by the first call, which sleeps until each is due,
+    // so that timing doesn't depend on how often the caller runs. Messages
+    // due at the same time are sent in the order they were scheduled.
+    // Messages already due are sent at once.
+    //
+    // Only one thread at a time may schedule. Messages sent immediately
+    // are written to the backend one call at a time with those of the
+    // output thread, so each arrives whole, though they may fall between
+    // scheduled messages. Returns false if the schedule is full.
+    //
+    bool sendAt(int64_t timeNs, const MidiCommand&);
+
+    // Schedules a batch of events, such as a lookahead window from a
+    // player, each at originNs plus its time. Returns the number
+    // scheduled, which is less than count if the schedule filled up.
+    //
+    size_t sendAt(const MidiRtEvent*, size_t count, int64_t originNs = 0);
+
+    // Discards the messages scheduled so far, that haven't been sent,
+    // except note offs, which are sent at once so that no note is left
+    // hanging
+    //
+    void clearScheduled();
+
+    // Suppresses channel messages that wouldn't change the device's
+    // state, such as a repeated controller value, program change, pitch
+    // bend, or channel pressure, which songs and generative code often
+    // resend. Controllers that act rather than set a value, such as data
+    // entry and the channel mode messages, always pass. The state is
+    // tracked per port, and forgotten when a port is opened. Immediate
+    // and scheduled messages are filtered together, in the order they are
+    // written to the backend. Off by default.
+    //
+    void setFilterRedundant(bool);
+    bool filterRedundant() const;
+
+    // Sends a message even if the filter would suppress it
+    void resend(const MidiCommand*);
+
+    // Forgets the tracked state, for instance after the device has been
+    // reset behind the port's back, so that each value is sent again
+    void resetFilter();
+    uint64_t filteredCount() const;
+
+    // Sends a buffer of one or more SysEx messages, such as a firmware
+    // or sample dump, on the calling thread. The buffer is split at each
+    // F7, and each complete message is handed to the backend in place,
+    // without copying, paced as the options ask. Bytes outside a message,
+    // and messages broken by a status byte before their F7, are skipped.
+    // Returns false if anything was skipped, or the progress callback
+    // cancelled the send.
+    //
+    // The backends take a SysEx message whole, so a message is never
+    // split; a dump meant for a device with a small buffer should already
+    // be made of small messages. On Windows, RtMidi's WinMM backend
+    // copies each message and blocks until the driver has sent it, so
+    // pacing there is in addition to the time each message takes.
+    //
+    // Scheduled or paced messages may be sent between the SysEx messages
+    // of a dump, but never within one. While the port is paced, each
+    // SysEx message also waits for the modelled wire, and occupies it
+    // for its length, so paced messages wait for it in turn.
+    //
+    bool sendSysEx(const uint8_t* data, size_t size, const MidiSysExOptions& = MidiSysExOptions());
+
+    // As sendSysEx, streaming the messages from a file, such as a .syx
+    // dump, which is memory mapped rather than read into memory. Returns
+    // false if the file can't be mapped.
+    //
+    bool sendSysExFile(const char* path, const MidiSysExOptions& = MidiSysExOptions());
+
+    // Paces output to a link's bandwidth, in bytes per second, such as
+    // kDinBytesPerSecond for a 5 pin DIN port, whose interface would
+    // otherwise drop the bytes of a burst it can't buffer. Zero turns
+    // pacing off, which is the default.
+    //
+    // While pacing, every message, scheduled or not, is sent by the
+    // output thread, which models when the wire will be free, and holds
+    // back messages until it is. Note offs and realtime messages go
+    // ahead of waiting messages, except a note on of the same note. The
+    // same single thread rule as sendAt applies to all sends. A burst
+    // larger than the schedule holds is cut short, and the messages that
+    // didn't fit are counted as dropped in the stats.
+    //
+    static const int kDinBytesPerSecond = 3125;
+    void setPacing(int bytesPerSecond);
+    int pacing() const;
+
+    MidiOutPacingStats pacingStats() const;
+    void resetPacingStats();
+
+    // user data will be a MidiOut pointer
     static void playerCallback(void* userData, MidiRtEvent*);
 
 private:
@@ -199,6 +469,28 @@ private:
     Detail* _detail;
 };
 
+// MidiLoopbackOut is an output whose messages arrive at a MidiIn, in
+// process, through the same path as messages from a port, including the
+// queue, coalescing, callbacks, and sinks. It allows the input and output
+// paths to be exercised, and measured, without MIDI hardware or an OS MIDI
+// service. The input needn't have a port open, and shouldn't, as its
+// receive path expects one producer. Messages are delivered on the
+// sending thread, which must be only one at a time.
+//
+class MidiLoopbackOut : public MidiOutBase {
+public:
+    explicit MidiLoopbackOut(MidiIn*);
+
+    // Sends a complete message, such as SysEx
+    void send(const uint8_t* data, size_t size);
+
+    virtual void command(const MidiCommand*);
+
+private:
+    MidiIn* in;
+    int64_t lastNs;
+};
+
     
 } // Lab
     
@@ -0,0 +1,67 @@
+//
+//  LabMidiPlayerThread.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <stdint.h>
+
+namespace Lab {
+
+    class MidiScheduler;
+    class MidiSongPlayer;
+
+    // Dispatch timing measured by a MidiPlayerThread. Lateness is the time
+    // between an event's deadline and the moment the thread dispatched it.
+    //
+    struct MidiPlayerThreadStats {
+        uint64_t wakeups = 0;        // number of times the thread woke up
+        uint64_t dispatches = 0;     // number of wakeups that dispatched events
+        int64_t meanLatenessNs = 0;
+        int64_t maxLatenessNs = 0;
+    };
+
+    // MidiPlayerThread drives a MidiSongPlayer from a dedicated thread.
+    // Instead of polling update() in a loop, the thread computes the
+    // deadline of the next event and sleeps until it on the monotonic
+    // clock, so an idle player costs next to nothing.
+    //
+    // The thread can alternatively drive a MidiScheduler, in which case
+    // it sleeps until the earliest event over all the scheduled players.
+    //
+    // The wall clock is the time since start() was called. The player or
+    // scheduler must not be updated from any other thread while the thread
+    // is running.
+    //
+    class MidiPlayerThread {
+    public:
+        MidiPlayerThread(MidiSongPlayer*);
+        MidiPlayerThread(MidiScheduler*);
+        ~MidiPlayerThread();
+
+        // Starts the thread, and plays a song player from the beginning.
+        // If spinNs is not zero, the thread wakes up that many nanoseconds
+        // early and busy waits for the remainder, trading some CPU for
+        // less jitter.
+        //
+        void start(int64_t spinNs = 0);
+        void stop();
+
+        // True from start() until stop() is called, or until the song
+        // finishes when driving a song player.
+        //
+        bool running() const;
+
+        MidiPlayerThreadStats stats() const;
+        void resetStats();
+
+    private:
+        class Detail;
+        Detail* _detail;
+    };
+
+} // Lab
@@ -0,0 +1,79 @@
+//
+//  LabMidiRecorder.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Lab {
+
+    class MidiIn;
+    class MidiSong;
+    struct MidiInMessage;
+
+    // MidiRecorder captures the messages arriving at a MidiIn, and turns
+    // them into a MidiSong, which can then be saved with writeMidi.
+    //
+    // All capture memory is allocated when the recorder is constructed, as
+    // chunks of fixed size records, plus a pool for SysEx, so recording
+    // never allocates on the input thread. Once the memory is used up,
+    // further messages are dropped, and counted.
+    //
+    // Messages are timed by their arrival time on the monotonic clock,
+    // relative to the call to start(). Realtime messages, such as timing
+    // clock and active sensing, are not recorded.
+    //
+    // A recorder captures from one input; record() must only be called
+    // from one thread at a time.
+    //
+    class MidiRecorder {
+    public:
+        // chunkCount chunks of chunkSize messages each are allocated up front
+        MidiRecorder(size_t chunkSize = 4096, size_t chunkCount = 64, size_t sysexCapacity = 1 << 20);
+        ~MidiRecorder();
+
+        // Registers a message callback that records into this recorder.
+        // Attaching to another input detaches from the first. Once detach
+        // returns, the input no longer calls into the recorder, and the
+        // recorder detaches itself when it is destroyed, so the input
+        // must outlive it or be detached first.
+        //
+        void attach(MidiIn*);
+        void detach(MidiIn*);
+
+        // Discards anything previously captured, and starts recording
+        void start();
+
+        // Stops recording. Once stop returns, record will not touch the
+        // capture, so it is safe to build a song.
+        void stop();
+
+        bool recording() const;
+
+        // Captures a message, if recording. Called by the attached input,
+        // but may also be called directly.
+        void record(const MidiInMessage&);
+
+        size_t messageCount() const;
+        uint64_t droppedCount() const;
+
+        // Builds a song from the capture. The first track holds the tempo,
+        // and any SysEx and system common messages; it is followed by a
+        // track for each channel that received messages. Times are
+        // converted to ticks at the given tempo and resolution. Call when
+        // not recording.
+        //
+        void buildSong(MidiSong& song, float beatsPerMinute = 120, int ticksPerBeat = 480) const;
+
+    private:
+        class Detail;
+        Detail* _detail;
+    };
+
+} // Lab
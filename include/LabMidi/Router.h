@@ -0,0 +1,65 @@
+//
+//  LabMidiRouter.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include "LabMidi/MidiInOut.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Lab {
+
+    // MidiRouter is a sink that fans events out to many outputs. Events
+    // are routed by their source track, or by their channel, to any
+    // number of destinations, optionally moving them to another channel.
+    //
+    // Each destination has its own wait-free queue and worker thread, so
+    // routing never waits on an output; a slow device only delays its own
+    // queue. If a destination's queue is full, its events are dropped,
+    // and counted.
+    //
+    // Routes may be changed from any thread while events are flowing.
+    // Each route that matches an event delivers a copy, so an event that
+    // matches a track route and a channel route to the same destination
+    // is sent twice. events() must only be called from one thread at a
+    // time, such as the thread updating a player.
+    //
+    class MidiRouter : public MidiEventSink {
+    public:
+        // each destination's queue holds queueCapacity events
+        explicit MidiRouter(size_t queueCapacity = 4096);
+        virtual ~MidiRouter();
+
+        // Adds a destination, and starts its worker. The destination must
+        // outlive the router. Returns the destination's index.
+        //
+        int addDestination(MidiOutBase*);
+        int destinationCount() const;
+
+        // Routes a track, or a channel, to a destination. If channel is
+        // not -1, channel messages are moved to that channel. Returns
+        // false if an argument is out of range.
+        //
+        bool routeTrack(int track, int destination, int channel = -1);
+        bool routeChannel(int sourceChannel, int destination, int channel = -1);
+        void clearRoutes();
+
+        virtual void events(const MidiRtEvent*, size_t count);
+
+        // Waits until every destination's queue has been delivered
+        void flush();
+
+        uint64_t droppedCount(int destination) const;
+
+    private:
+        class Detail;
+        Detail* _detail;
+    };
+
+} // Lab
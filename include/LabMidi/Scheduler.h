@@ -0,0 +1,81 @@
+//
+//  LabMidiScheduler.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Lab {
+
+    class MidiSongPlayer;
+
+    // MidiScheduler drives many MidiSongPlayers from a single clock. It
+    // keeps a priority queue of each player's next event time, so an
+    // update only touches the players that have something due, and
+    // events are dispatched across players in time order. The cost per
+    // dispatched event is O(log n) in the number of scheduled players.
+    //
+    // As with MidiSongPlayer, add, remove, and wake are posted to a
+    // wait-free queue that update() drains, so they may be called from one
+    // control thread while another thread drives update(). They return
+    // false if the queue is full. The queue is sized so that maxPlayers
+    // players can each be added and removed before the next update.
+    //
+    // The scheduler does not take ownership of the players. A player must
+    // not be updated by anything other than the scheduler while it is
+    // scheduled.
+    //
+    class MidiScheduler {
+    public:
+        explicit MidiScheduler(size_t maxPlayers = 4096);
+        ~MidiScheduler();
+
+        bool add(MidiSongPlayer*);
+
+        // A removed player is still in use until the next update() has
+        // applied the removal. It may be destroyed once settled() returns
+        // true, or at any time if no thread is driving update().
+        //
+        bool remove(MidiSongPlayer*);
+
+        // Posting a command to a scheduled player, such as play or seek,
+        // changes when its next event is due. Call wake after doing so to
+        // have the scheduler pick up the change.
+        //
+        bool wake(MidiSongPlayer*);
+
+        // True once update() has applied every add, remove, and wake
+        // posted so far. Call from the control thread.
+        //
+        bool settled() const;
+
+        // Dispatch all events due at or before wallClockTime, in
+        // nanoseconds or seconds
+        //
+        void updateNs(int64_t wallClockTime);
+        void update(float wallClockTime);
+
+        // The wall clock time at which the next event over all players is
+        // due, or the maximum int64_t or float value if nothing is due.
+        // Call from the thread driving update().
+        //
+        int64_t nextEventTimeNs() const;
+        float nextEventTime() const;
+
+        // The number of players added and not yet removed, as of the last
+        // update. May be called from any thread.
+        //
+        size_t playerCount() const;
+
+    private:
+        class Detail;
+        Detail* _detail;
+    };
+
+} // Lab
@@ -105,6 +105,18 @@ namespace Lab {
     // Convert a bpm value to a named tempo such as Largo
     //
     char const*const bpmToTempoName(int bpm);
+
+    // Read the monotonic clock, in nanoseconds. The epoch is arbitrary, so
+    // only differences between two readings are meaningful.
+    //
+    int64_t monotonicNanoseconds();
+
+    // Sleep until the monotonic clock reaches deadline, in nanoseconds.
+    // Returns immediately if the deadline has already passed. On Linux the
+    // sleep is an absolute deadline sleep, so an interrupted or late
+    // wakeup doesn't accumulate drift.
+    //
+    void sleepUntilNanoseconds(int64_t deadline);
     
 } // Lab
     
@@ -0,0 +1,138 @@
+//
+//  LabMidiHistogram.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace Lab {
+
+    // A histogram of non-negative integer samples with log-linear buckets:
+    // values below 16 have a bucket each, and every power of two above
+    // that is split into 16 buckets, so the error of a reported
+    // percentile is under 1/16th of its value. Recording is a relaxed
+    // atomic increment, so one thread can record while others read.
+    // Only one thread may record at a time.
+    //
+    class Histogram {
+    public:
+        static const int kSubBuckets = 16;
+        static const int kBuckets = kSubBuckets + (63 - 4) * kSubBuckets;
+
+        Histogram() { reset(); }
+
+        void reset()
+        {
+            for (int i = 0; i < kBuckets; ++i)
+                buckets[i].store(0, std::memory_order_relaxed);
+            count.store(0, std::memory_order_relaxed);
+            sum.store(0, std::memory_order_relaxed);
+            maximum.store(0, std::memory_order_relaxed);
+        }
+
+        void record(int64_t value)
+        {
+            if (value < 0)
+                value = 0;
+            buckets[bucketIndex(uint64_t(value))].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            sum.fetch_add(value, std::memory_order_relaxed);
+            if (value > maximum.load(std::memory_order_relaxed))
+                maximum.store(value, std::memory_order_relaxed);
+        }
+
+        uint64_t samples() const { return count.load(std::memory_order_relaxed); }
+        int64_t max() const { return maximum.load(std::memory_order_relaxed); }
+
+        double mean() const
+        {
+            uint64_t c = samples();
+            return c ? double(sum.load(std::memory_order_relaxed)) / double(c) : 0.;
+        }
+
+        // p is a fraction, such as 0.99; the result is the midpoint of the
+        // bucket containing that percentile
+        int64_t percentile(double p) const
+        {
+            uint64_t total = 0;
+            for (int i = 0; i < kBuckets; ++i)
+                total += buckets[i].load(std::memory_order_relaxed);
+            if (!total)
+                return 0;
+
+            uint64_t rank = uint64_t(p * double(total));
+            if (rank >= total)
+                rank = total - 1;
+            uint64_t seen = 0;
+            for (int i = 0; i < kBuckets; ++i) {
+                seen += buckets[i].load(std::memory_order_relaxed);
+                if (seen > rank) {
+                    int64_t mid = int64_t(bucketLow(i) + bucketWidth(i) / 2);
+                    int64_t m = max();
+                    return mid < m ? mid : m;
+                }
+            }
+            return max();
+        }
+
+        // writes one line per non-empty bucket: lower bound, upper bound, count
+        void write(FILE* f) const
+        {
+            for (int i = 0; i < kBuckets; ++i) {
+                uint64_t c = buckets[i].load(std::memory_order_relaxed);
+                if (c)
+                    fprintf(f, "%llu %llu %llu\n",
+                            (unsigned long long) bucketLow(i),
+                            (unsigned long long) (bucketLow(i) + bucketWidth(i) - 1),
+                            (unsigned long long) c);
+            }
+        }
+
+    private:
+        static int log2(uint64_t v)
+        {
+            int e = 0;
+            while (v >>= 1)
+                ++e;
+            return e;
+        }
+
+        static int bucketIndex(uint64_t v)
+        {
+            if (v < kSubBuckets)
+                return int(v);
+            int e = log2(v);
+            return kSubBuckets + (e - 4) * kSubBuckets + int((v >> (e - 4)) & (kSubBuckets - 1));
+        }
+
+        static uint64_t bucketLow(int i)
+        {
+            if (i < kSubBuckets)
+                return uint64_t(i);
+            int e = (i - kSubBuckets) / kSubBuckets + 4;
+            uint64_t sub = uint64_t((i - kSubBuckets) % kSubBuckets);
+            return (uint64_t(1) << e) + (sub << (e - 4));
+        }
+
+        static uint64_t bucketWidth(int i)
+        {
+            if (i < kSubBuckets)
+                return 1;
+            int e = (i - kSubBuckets) / kSubBuckets + 4;
+            return uint64_t(1) << (e - 4);
+        }
+
+        std::atomic<uint64_t> buckets[kBuckets];
+        std::atomic<uint64_t> count;
+        std::atomic<int64_t> sum;
+        std::atomic<int64_t> maximum;
+    };
+
+} // Lab
@@ -30,18 +30,138 @@
  */
 
 #include "LabMidi/MidiInOut.h"
+#include "LabMidi/Util.h"
+#include "LabMidiInQueue.h"
+#include "LabMidiMessage.h"
+#include "LabMidiRcu.h"
 
 #include "RtMidi.h"
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdio.h>
 
 namespace Lab {
     
+    namespace {
+        
+        // Thins out continuous controller floods in a batch of messages
+        // taken from the queue's backlog. A control change, pitch bend, or
+        // pressure message is dropped if a later message in the batch for
+        // the same controller arrived within the window, as only the
+        // latest value matters. Nothing is held over to a later batch,
+        // which would delay the latest value until the next drain. Any
+        // other message on a channel, such as a note, is a barrier, so
+        // that the controller values a note starts with are preserved.
+        // Controllers whose every value matters, such as bank select,
+        // data entry, and RPN and NRPN, and channel mode messages, are
+        // never dropped.
+        //
+        class Coalescer {
+        public:
+            Coalescer()
+            : window(0)
+            , delivered(0)
+            , dropped(0)
+            , counter(0)
+            {
+                for (int i = 0; i < kKeys; ++i)
+                    keyStamp[i] = 0;
+                for (int i = 0; i < 16; ++i)
+                    channelStamp[i] = 0;
+            }
+            
+            // returns the number of messages remaining at the start of msg
+            size_t coalesce(MidiInMessage* msg, size_t count)
+            {
+                int64_t w = window.load(std::memory_order_relaxed);
+                if (w <= 0 || count < 2) {
+                    delivered.fetch_add(count, std::memory_order_relaxed);
+                    return count;
+                }
+                
+                for (int c = 0; c < 16; ++c)
+                    channelStamp[c] = ++counter;
+                
+                // walk backwards, compacting the kept messages to the end
+                size_t kept = count;
+                for (size_t i = count; i-- > 0; ) {
+                    const MidiInMessage& m = msg[i];
+                    int k = m.size ? key(m.data, m.size) : -1;
+                    bool keep = true;
+                    if (k >= 0) {
+                        int c = m.data[0] & 0x0f;
+                        if (keyStamp[k] == channelStamp[c] && keyTime[k] - m.arrivalNs <= w)
+                            keep = false;
+                        else {
+                            keyStamp[k] = channelStamp[c];
+                            keyTime[k] = m.arrivalNs;
+                        }
+                    }
+                    else if (m.size && m.data[0] < 0xf0)
+                        channelStamp[m.data[0] & 0x0f] = ++counter;
+                    
+                    if (keep)
+                        msg[--kept] = m;
+                }
+                
+                size_t n = count - kept;
+                if (kept)
+                    std::move(msg + kept, msg + count, msg);
+                delivered.fetch_add(n, std::memory_order_relaxed);
+                dropped.fetch_add(count - n, std::memory_order_relaxed);
+                return n;
+            }
+            
+            std::atomic<int64_t> window;
+            
+            // the count of messages passed on, and dropped
+            std::atomic<uint64_t> delivered;
+            std::atomic<uint64_t> dropped;
+            
+        private:
+            // keys are control changes, then pitch bend, channel pressure,
+            // and poly pressure
+            static const int kKeys = 16 * 128 + 16 + 16 + 16 * 128;
+            
+            static int key(const uint8_t* d, size_t size)
+            {
+                int c = d[0] & 0x0f;
+                switch (d[0] & 0xf0) {
+                    case MIDI_CONTROL_CHANGE: {
+                        if (size < 3)
+                            return -1;
+                        int cc = d[1] & 0x7f;
+                        if (cc == 0 || cc == 32 || cc == 6 || cc == 38 || (cc >= 96 && cc <= 101) || cc >= 120)
+                            return -1;
+                        return c * 128 + cc;
+                    }
+                    case MIDI_PITCH_BEND:
+                        return 16 * 128 + c;
+                    case MIDI_CHANNEL_PRESSURE:
+                        return 16 * 128 + 16 + c;
+                    case MIDI_POLY_PRESSURE:
+                        return size < 2 ? -1 : 16 * 128 + 32 + c * 128 + (d[1] & 0x7f);
+                }
+                return -1;
+            }
+            
+            // a key's stamp matches its channel's stamp if a later message
+            // for the key was kept since the last barrier on the channel
+            uint32_t keyStamp[kKeys];
+            int64_t keyTime[kKeys];
+            uint32_t channelStamp[16];
+            uint32_t counter;
+        };
+        
+    } // anon
     
     class MidiIn::Detail {
     public:
         Detail()
         : verbose(false)
         , port(-1)
+        , elapsed(0)
         {
             try {
                 midiIn = new RtMidiIn();
@@ -71,6 +191,7 @@ namespace Lab {
             try {
                 midiIn->openPort(port);
                 midiIn->setCallback(&midiInCallback, this);
+                elapsed = 0;
                 
                 // Don't ignore sysex, timing, or active sensing messages.
                 midiIn->ignoreTypes(false, false, false);
@@ -95,6 +216,8 @@ namespace Lab {
             try {
                 midiIn->openVirtualPort(port);
                 midiIn->setCallback(&midiInCallback, this);
+                elapsed = 0;
+                midiIn->ignoreTypes(false, false, false);
             }
             catch(const RtMidiError&) {
                 return false;
@@ -105,37 +228,123 @@ namespace Lab {
         // RtMidi compatible callback function
         void manageNewMessage(double deltatime, std::vector<unsigned char>* message)
         {
-            size_t nBytes = message->size();
-            if (verbose) {
-                std::cout << "num bytes: " << nBytes;
-                for (unsigned int i = 0; i < nBytes; i++)
-                    std::cout << " Byte " << i << " = " << (int)message->at(i) << ", ";
-                if (nBytes > 0)
-                    std::cout << "stamp = " << deltatime << '\n';
+            // read the clock first, so the stamp is as close to arrival as
+            // possible
+            int64_t arrivalNs = monotonicNanoseconds();
+            receive(arrivalNs, deltatime, message->data(), message->size());
+        }
+        
+        // the receive path shared by RtMidi and MidiLoopbackOut
+        void receive(int64_t arrivalNs, double deltatime, const uint8_t* data, size_t nBytes)
+        {
+            elapsed += deltatime;
+            if (nBytes > 0) {
+                MidiInMessage msg;
+                msg.timeNs = int64_t(elapsed * 1.0e9);
+                msg.arrivalNs = arrivalNs;
+                msg.data = data;
+                msg.size = nBytes;
+                if (queue)
+                    queue->push(msg);
+                else
+                    deliver(msg);
+            }
+        }
+        
+        // Formats into a stack buffer and writes it in one go, as this may
+        // run on the receive thread. Only the start of a long SysEx is shown.
+        void print(const MidiInMessage& msg)
+        {
+            const uint8_t* data = msg.data;
+            size_t size = msg.size;
+            char line[512];
+            int n = snprintf(line, sizeof(line), "num bytes: %d", int(size));
+            size_t shown = std::min(size, size_t(12));
+            for (size_t i = 0; i < shown; ++i)
+                n += snprintf(line + n, sizeof(line) - n, " Byte %d = %d,", int(i), int(data[i]));
+            if (shown < size)
+                n += snprintf(line + n, sizeof(line) - n, " ...");
+            if (size > 0)
+                n += snprintf(line + n, sizeof(line) - n, " stamp = %g", double(msg.timeNs) * 1.0e-9);
+            n += snprintf(line + n, sizeof(line) - n, "\n");
+            fwrite(line, 1, size_t(n), stdout);
+        }
+        
+        // Invokes the message callbacks and callbacks for a message, and
+        // returns it as an event for the sinks
+        MidiRtEvent notify(const MidiInMessage& msg)
+        {
+            if (verbose)
+                print(msg);
+            
+            {
+                RcuList<MessageCallback>::Reader cb(messageCallbacks);
+                for (auto i = cb.begin(); i != cb.end(); ++i)
+                    (*i).second((*i).first, &msg);
             }
             
-            if (nBytes > 0) {
-                MidiCommand mc;
-                mc.command = message->at(0);
-                mc.byte1 = 0;
-                mc.byte2 = 0;
-                
-                if (nBytes > 1)
-                    mc.byte1 = int(message->at(1));
-                if (nBytes > 2)
-                    mc.byte2 = int(message->at(2));
-                
-                for (auto i = callbacks.begin(); i != callbacks.end(); ++i)
+            MidiRtEvent ev;
+            ev.timeNs = msg.timeNs;
+            MidiCommand& mc = ev.command;
+            mc.command = msg.data[0];
+            mc.byte1 = 0;
+            mc.byte2 = 0;
+            
+            if (msg.size > 1)
+                mc.byte1 = msg.data[1];
+            if (msg.size > 2)
+                mc.byte2 = msg.data[2];
+            
+            {
+                RcuList<Callback>::Reader cb(callbacks);
+                for (auto i = cb.begin(); i != cb.end(); ++i)
                     (*i).second((*i).first, &mc);
             }
+            return ev;
+        }
+        
+        void sink(const MidiRtEvent* ev, size_t count)
+        {
+            RcuList<MidiEventSink*>::Reader s(sinks);
+            for (auto i = s.begin(); i != s.end(); ++i)
+                (*i)->events(ev, count);
         }
-
         
+        // Runs on the receive thread, as each message arrives
+        void deliver(const MidiInMessage& msg)
+        {
+            MidiRtEvent ev = notify(msg);
+            sink(&ev, 1);
+        }
+        
+        // Runs on the thread calling dispatch. The callbacks are invoked
+        // for each message in turn, then each sink receives the whole
+        // batch in one call.
+        void deliver(const MidiInMessage* msg, size_t count)
+        {
+            MidiRtEvent ev[kDispatchBatch];
+            for (size_t i = 0; i < count; ++i)
+                ev[i] = notify(msg[i]);
+            sink(ev, count);
+        }
+        
+        static const size_t kDispatchBatch = 64;
+        
+        typedef std::pair<void*, MidiCallbackFn> Callback;
+        typedef std::pair<void*, MidiMessageCallbackFn> MessageCallback;
+
         RtMidiIn*    midiIn;
         unsigned int port;
         bool         verbose;
+        double       elapsed;   // seconds since the port was opened
+        
+        // read on the delivering thread, written from any thread
+        RcuList<Callback> callbacks;
+        RcuList<MessageCallback> messageCallbacks;
+        RcuList<MidiEventSink*> sinks;
         
-        std::vector<std::pair<void*, MidiCallbackFn> > callbacks;
+        std::unique_ptr<MidiInQueue> queue;
+        Coalescer coalescer;
     };
     
     MidiIn::MidiIn()
@@ -170,20 +379,93 @@ namespace Lab {
         
     void MidiIn::addCallback(MidiCallbackFn f, void* userData)
     {
-        _detail->callbacks.push_back(std::pair<void*, MidiCallbackFn>(userData, f));
+        _detail->callbacks.add(Detail::Callback(userData, f));
     }
     
     void MidiIn::removeCallback(void* userData)
     {
-        std::vector<std::pair<void*, MidiCallbackFn> >::iterator i = _detail->callbacks.begin();
-        while (i != _detail->callbacks.end()) {
-            if (userData == (*i).first) {
-                _detail->callbacks.erase(i);
-                i = _detail->callbacks.begin();
-            }
-            else
-                ++i;
+        _detail->callbacks.removeIf([userData](const Detail::Callback& c) { return c.first == userData; });
+        _detail->callbacks.synchronize();
+    }
+    
+    void MidiIn::addMessageCallback(MidiMessageCallbackFn f, void* userData)
+    {
+        _detail->messageCallbacks.add(Detail::MessageCallback(userData, f));
+    }
+    
+    void MidiIn::removeMessageCallback(void* userData)
+    {
+        _detail->messageCallbacks.removeIf([userData](const Detail::MessageCallback& c) { return c.first == userData; });
+        _detail->messageCallbacks.synchronize();
+    }
+    
+    void MidiIn::addSink(MidiEventSink* sink)
+    {
+        if (sink)
+            _detail->sinks.add(sink);
+    }
+    
+    void MidiIn::removeSink(MidiEventSink* sink)
+    {
+        _detail->sinks.removeIf([sink](MidiEventSink* s) { return s == sink; });
+        _detail->sinks.synchronize();
+    }
+    
+    void MidiIn::enableQueue(size_t capacity, size_t sysexCapacity)
+    {
+        _detail->queue.reset(new MidiInQueue(capacity, sysexCapacity));
+    }
+    
+    bool MidiIn::read(MidiInMessage& msg)
+    {
+        return _detail->queue && _detail->queue->read(msg);
+    }
+    
+    bool MidiIn::wait(MidiInMessage& msg, int64_t timeoutNs)
+    {
+        return _detail->queue && _detail->queue->wait(msg, timeoutNs);
+    }
+    
+    size_t MidiIn::drain(MidiInMessage* out, size_t max)
+    {
+        if (!_detail->queue)
+            return 0;
+        return _detail->coalescer.coalesce(out, _detail->queue->drain(out, max));
+    }
+    
+    size_t MidiIn::dispatch()
+    {
+        if (!_detail->queue)
+            return 0;
+        size_t count = 0;
+        MidiInMessage batch[Detail::kDispatchBatch];
+        while (size_t n = _detail->queue->drain(batch, Detail::kDispatchBatch)) {
+            n = _detail->coalescer.coalesce(batch, n);
+            if (n)
+                _detail->deliver(batch, n);
+            count += n;
         }
+        return count;
+    }
+    
+    void MidiIn::setCoalescing(int64_t windowNs)
+    {
+        _detail->coalescer.window.store(windowNs, std::memory_order_relaxed);
+    }
+    
+    uint64_t MidiIn::coalescedDelivered() const
+    {
+        return _detail->coalescer.delivered.load(std::memory_order_relaxed);
+    }
+    
+    uint64_t MidiIn::coalescedDropped() const
+    {
+        return _detail->coalescer.dropped.load(std::memory_order_relaxed);
+    }
+    
+    uint64_t MidiIn::queueOverflows() const
+    {
+        return _detail->queue ? _detail->queue->overflowCount() : 0;
     }
     
     void MidiIn::setVerbose(bool verbose)
@@ -191,4 +473,31 @@ namespace Lab {
         _detail->verbose = verbose;
     }
     
+    //------------------------------------------------------------------------
+    
+    MidiLoopbackOut::MidiLoopbackOut(MidiIn* in)
+    : in(in)
+    , lastNs(0)
+    {
+    }
+    
+    void MidiLoopbackOut::send(const uint8_t* data, size_t size)
+    {
+        if (!in || !size)
+            return;
+        
+        // the time since the previous message stands in for RtMidi's
+        // delta time, the first message's being zero
+        int64_t now = monotonicNanoseconds();
+        double deltatime = lastNs ? double(now - lastNs) * 1.0e-9 : 0.;
+        lastNs = now;
+        in->_detail->receive(now, deltatime, data, size);
+    }
+    
+    void MidiLoopbackOut::command(const MidiCommand* mc)
+    {
+        uint8_t data[3] = { mc->command, mc->byte1, mc->byte2 };
+        send(data, messageSize(mc->command));
+    }
+    
 } // Lab
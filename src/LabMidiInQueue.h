@@ -0,0 +1,194 @@
+//
+//  LabMidiInQueue.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include "LabMidi/MidiInOut.h"
+#include "LabMidiRing.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace Lab {
+
+    // The queue between a MidiIn's receive thread and a consumer thread.
+    // Each message is a fixed size record in a wait-free ring. Messages
+    // too long to fit in a record, such as SysEx, are spilled to a byte
+    // ring allocated up front, so the receive thread never allocates.
+    //
+    // Messages read from the queue stay in place until the next read, so
+    // that the consumer can use the bytes without copying them.
+    //
+    // A consumer may poll, or block. A blocked consumer raises a flag
+    // before waiting on a condition variable, and the producer only takes
+    // the lock to signal it when the flag is raised.
+    //
+    class MidiInQueue {
+    public:
+        MidiInQueue(size_t messageCapacity, size_t sysexCapacity)
+        : records(messageCapacity)
+        , bytes(sysexCapacity)
+        , byteHead(0)
+        , byteTail(0)
+        , overflows(0)
+        , waiting(false)
+        , holding(0)
+        {
+        }
+
+        // producer side; returns false, and counts an overflow, if there
+        // is no room for the message
+        bool push(const MidiInMessage& msg)
+        {
+            size_t size = msg.size;
+            Record r;
+            r.timeNs = msg.timeNs;
+            r.arrivalNs = msg.arrivalNs;
+            r.size = uint32_t(size);
+            if (size <= sizeof(r.bytes)) {
+                memcpy(r.bytes, msg.data, size);
+                r.byteEnd = byteTail;
+            }
+            else {
+                uint64_t start;
+                if (!allocateBytes(size, start)) {
+                    overflows.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                memcpy(&bytes[start % bytes.size()], msg.data, size);
+                r.byteEnd = start + size;
+            }
+            if (!records.push(r)) {
+                overflows.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            byteTail = r.byteEnd;
+
+            // pairs with the fence in wait, so that either the consumer
+            // sees the message, or the producer sees the consumer waiting
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiting.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(mutex);
+                signal.notify_one();
+            }
+            return true;
+        }
+
+        // consumer side; releases the previously read messages, and reads
+        // the next, returning false if the queue is empty
+        bool read(MidiInMessage& msg)
+        {
+            return drain(&msg, 1) == 1;
+        }
+
+        // consumer side; releases the previously read messages, and reads
+        // up to max messages, returning the number read
+        size_t drain(MidiInMessage* out, size_t max)
+        {
+            release();
+            size_t n = 0;
+            for (; n < max; ++n) {
+                Record* r = records.peek(n);
+                if (!r)
+                    break;
+                MidiInMessage& msg = out[n];
+                msg.timeNs = r->timeNs;
+                msg.arrivalNs = r->arrivalNs;
+                msg.size = r->size;
+                if (r->size <= sizeof(r->bytes))
+                    msg.data = r->bytes;
+                else
+                    msg.data = &bytes[(r->byteEnd - r->size) % bytes.size()];
+            }
+            holding = n;
+            return n;
+        }
+
+        // consumer side; as read, but waits up to timeoutNs for a message
+        // to arrive. A negative timeout waits indefinitely.
+        bool wait(MidiInMessage& msg, int64_t timeoutNs)
+        {
+            if (read(msg))
+                return true;
+
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::nanoseconds(timeoutNs);
+            std::unique_lock<std::mutex> lock(mutex);
+            waiting.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            bool ok;
+            while (!(ok = read(msg))) {
+                if (timeoutNs < 0)
+                    signal.wait(lock);
+                else if (signal.wait_until(lock, deadline) == std::cv_status::timeout) {
+                    ok = read(msg);
+                    break;
+                }
+            }
+            waiting.store(false, std::memory_order_relaxed);
+            return ok;
+        }
+
+        // consumer side; releases the last messages read
+        void release()
+        {
+            if (!holding)
+                return;
+            byteHead.store(records.peek(holding - 1)->byteEnd, std::memory_order_release);
+            records.popFront(holding);
+            holding = 0;
+        }
+
+        uint64_t overflowCount() const { return overflows.load(std::memory_order_relaxed); }
+
+    private:
+        struct Record {
+            int64_t timeNs;
+            int64_t arrivalNs;
+            uint64_t byteEnd;   // byte ring position after this message
+            uint32_t size;
+            uint8_t bytes[12];  // messages of this size or less are inline
+        };
+
+        // A spilled message is contiguous in the byte ring; if it won't fit
+        // before the end of the ring, the remainder of the ring is skipped.
+        // Once the consumer has released every spilled message, the whole
+        // ring is free, wherever the next message starts.
+        bool allocateBytes(size_t size, uint64_t& start)
+        {
+            uint64_t capacity = bytes.size();
+            if (size > capacity)
+                return false;
+            uint64_t pos = byteTail;
+            uint64_t offset = pos % capacity;
+            if (offset + size > capacity)
+                pos += capacity - offset;
+            uint64_t head = byteHead.load(std::memory_order_acquire);
+            if (head != byteTail && pos + size - head > capacity)
+                return false;
+            start = pos;
+            return true;
+        }
+
+        SpscRing<Record> records;
+        std::vector<uint8_t> bytes;
+        std::atomic<uint64_t> byteHead;     // written by the consumer
+        uint64_t byteTail;                  // producer only
+        std::atomic<uint64_t> overflows;
+
+        std::atomic<bool> waiting;
+        std::mutex mutex;
+        std::condition_variable signal;
+        size_t holding;                     // messages read, consumer only
+    };
+
+} // Lab
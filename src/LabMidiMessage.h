@@ -0,0 +1,45 @@
+//
+//  LabMidiMessage.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include "LabMidi/MidiInOut.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Lab {
+
+    // The length of a message, given its status byte. SysEx can't be
+    // carried by a MidiCommand, so it has no length here.
+    inline size_t messageSize(uint8_t status)
+    {
+        switch (status >> 4) {
+            case 0xc:
+            case 0xd:
+                return 2;
+            case 0xf:
+                break;
+            default:
+                return 3;
+        }
+        switch (status) {
+            case MIDI_SYSTEM_EXCLUSIVE:
+            case MIDI_EOX:
+                return 0;
+            case MIDI_TIME_CODE:
+            case MIDI_SONG_SELECT:
+                return 2;
+            case MIDI_SONG_POS_POINTER:
+                return 3;
+            default:
+                return 1;
+        }
+    }
+
+} // Lab
@@ -0,0 +1,74 @@
+//
+//  LabMidiMeta.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include "LabMidi/MidiFile.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace Lab {
+
+    const size_t kMaxMetaFieldBytes = 5;
+
+    // Tempo, time signature, key signature, SMPTE offset, channel prefix,
+    // and sequence number events are parsed into fields and leave data
+    // empty. Encodes the fields of such an event into out, as they appear
+    // in a file, and returns the number of bytes, or zero for any other
+    // event, whose bytes are in data.
+    //
+    inline size_t metaEventFields(const MidiEvent* event, uint8_t (&out)[kMaxMetaFieldBytes])
+    {
+        switch (event->eventType) {
+            case Midi_MetaEventType::SEQUENCE_NUMBER: {
+                uint16_t n = static_cast<const Event_SequenceNumber*>(event)->number;
+                out[0] = uint8_t(n >> 8);
+                out[1] = uint8_t(n);
+                return 2;
+            }
+            case Midi_MetaEventType::MIDI_CHANNEL_PREFIX:
+                out[0] = static_cast<const Event_MidiChannelPrefix*>(event)->channel;
+                return 1;
+            case Midi_MetaEventType::TEMPO_CHANGE: {
+                uint32_t t = uint32_t(static_cast<const Event_SetTempo*>(event)->microsecondsPerBeat);
+                out[0] = uint8_t(t >> 16);
+                out[1] = uint8_t(t >> 8);
+                out[2] = uint8_t(t);
+                return 3;
+            }
+            case Midi_MetaEventType::SMPTE_OFFSET: {
+                const Event_SmpteOffset* e = static_cast<const Event_SmpteOffset*>(event);
+                uint8_t rate = e->framerate == 25 ? 0x20 : e->framerate == 29 ? 0x40 : e->framerate == 30 ? 0x60 : 0;
+                out[0] = uint8_t(rate | e->hour);
+                out[1] = e->min;
+                out[2] = e->sec;
+                out[3] = e->frame;
+                out[4] = e->subframe;
+                return 5;
+            }
+            case Midi_MetaEventType::TIME_SIGNATURE: {
+                const Event_TimeSignature* e = static_cast<const Event_TimeSignature*>(event);
+                out[0] = e->numerator;
+                out[1] = e->denominator;
+                out[2] = e->metronome;
+                out[3] = e->thirtyseconds;
+                return 4;
+            }
+            case Midi_MetaEventType::KEY_SIGNATURE: {
+                const Event_KeySignature* e = static_cast<const Event_KeySignature*>(event);
+                out[0] = e->key;
+                out[1] = e->scale;
+                return 2;
+            }
+            default:
+                return 0;
+        }
+    }
+
+} // Lab
@@ -30,19 +30,221 @@
  */
 
 #include "LabMidi/MidiInOut.h"
+#include "LabMidi/Util.h"
+#include "LabMidiMessage.h"
+#include "LabMidiRing.h"
 
 #include "RtMidi.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace Lab {
 
+    namespace {
+
+        // The last state sent to a device's channels, so that messages
+        // which wouldn't change it can be suppressed. Controllers whose
+        // messages act rather than set a value, such as data entry,
+        // increment and decrement, the parameter number selects that data
+        // entry is relative to, and the channel mode messages, are never
+        // suppressed. A bank select changes what a program change means,
+        // so it makes the program unknown; reset all controllers makes the
+        // channel's controllers unknown, and a system reset everything.
+        //
+        class ChannelState {
+        public:
+            ChannelState() { reset(); }
+            
+            void reset()
+            {
+                memset(cc, kUnknown, sizeof(cc));
+                for (int i = 0; i < 16; ++i)
+                    resetChannel(i, true);
+            }
+            
+            // updates the state, and returns true if the message changed
+            // nothing, and may be suppressed
+            bool redundant(const MidiCommand& mc)
+            {
+                if (mc.command >= MIDI_SYSTEM_EXCLUSIVE) {
+                    if (mc.command == MIDI_SYSTEM_RESET)
+                        reset();
+                    return false;
+                }
+                
+                int ch = mc.command & 0xf;
+                switch (mc.command & 0xf0) {
+                    case MIDI_CONTROL_CHANGE: {
+                        uint8_t n = mc.byte1 & 0x7f;
+                        if (n == 121) {
+                            resetChannel(ch, false);
+                            return false;
+                        }
+                        if (!cacheable(n))
+                            return false;
+                        if (n == 0 || n == 32)
+                            program[ch] = kUnknown;
+                        return set(cc[ch][n], mc.byte2);
+                    }
+                    case MIDI_PROGRAM_CHANGE:
+                        return set(program[ch], mc.byte1);
+                    case MIDI_CHANNEL_PRESSURE:
+                        return set(pressure[ch], mc.byte1);
+                    case MIDI_PITCH_BEND:
+                        return set(bend[ch], uint16_t(mc.byte1 | (mc.byte2 << 7)));
+                    default:
+                        return false;
+                }
+            }
+            
+        private:
+            static const uint8_t kUnknown = 0xff;
+            
+            static bool cacheable(uint8_t n)
+            {
+                return n != 6 && n != 38 && (n < 96 || n > 101) && n < 120;
+            }
+            
+            template <typename T>
+            static bool set(T& state, T value)
+            {
+                if (state == value)
+                    return true;
+                state = value;
+                return false;
+            }
+            
+            void resetChannel(int ch, bool all)
+            {
+                memset(cc[ch], kUnknown, sizeof(cc[ch]));
+                bend[ch] = 0xffff;
+                pressure[ch] = kUnknown;
+                if (all)
+                    program[ch] = kUnknown;
+            }
+            
+            uint8_t cc[16][128];
+            uint8_t program[16];
+            uint8_t pressure[16];
+            uint16_t bend[16];
+        };
+
+        // A read only view of a whole file, mapped into memory, so that a
+        // large dump is paged in as it is sent, rather than read up front
+        //
+        class MappedFile {
+        public:
+            explicit MappedFile(const char* path)
+            : data(nullptr)
+            , size(0)
+            {
+#if defined(_WIN32)
+                file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING,
+                                   FILE_FLAG_SEQUENTIAL_SCAN, 0);
+                mapping = 0;
+                LARGE_INTEGER length;
+                if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &length) || !length.QuadPart)
+                    return;
+                mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+                if (!mapping)
+                    return;
+                data = (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                if (data)
+                    size = size_t(length.QuadPart);
+#else
+                fd = open(path, O_RDONLY);
+                struct stat st;
+                if (fd < 0 || fstat(fd, &st) != 0 || st.st_size <= 0)
+                    return;
+                void* p = mmap(0, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED)
+                    return;
+                madvise(p, size_t(st.st_size), MADV_SEQUENTIAL);
+                data = (const uint8_t*) p;
+                size = size_t(st.st_size);
+#endif
+            }
+
+            ~MappedFile()
+            {
+#if defined(_WIN32)
+                if (data)
+                    UnmapViewOfFile(data);
+                if (mapping)
+                    CloseHandle(mapping);
+                if (file != INVALID_HANDLE_VALUE)
+                    CloseHandle(file);
+#else
+                if (data)
+                    munmap((void*) data, size);
+                if (fd >= 0)
+                    close(fd);
+#endif
+            }
+
+            const uint8_t* data;
+            size_t size;
+
+        private:
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator=(const MappedFile&) = delete;
+
+#if defined(_WIN32)
+            HANDLE file;
+            HANDLE mapping;
+#else
+            int fd;
+#endif
+        };
+
+        // The number of messages that may be scheduled ahead
+        const size_t kScheduleCapacity = 4096;
+        const int64_t kPacingBacklogNs = 1000000;
+        const int64_t kNever = INT64_MAX;
+
+    } // anon
+
     class MidiOut::Detail
     {
     public:
         Detail()
         : port(-1)
+        , nullPort(false)
+        , packs(false)
+        , wireFreeNs(0)
+        , pacing(0)
+        , filtering(false)
+        , forget(false)
+        , filtered(0)
+        , nextSeq(0)
+        , clearBefore(0)
+        , quit(false)
+        , waiting(false)
+        , kicked(false)
         {
+            memset(notesWaiting, 0, sizeof(notesWaiting));
+            resetPacingStats();
             try {
                 midiOut = new RtMidiOut();
+                packs = midiOut->getCurrentApi() == RtMidi::LINUX_ALSA;
             }
             catch(RtMidiError& error) {
                 midiOut = 0;
@@ -52,6 +254,7 @@ namespace Lab {
         
         ~Detail()
         {
+            stopScheduler();
             closePort();
         }
         
@@ -63,8 +266,18 @@ namespace Lab {
             }
         }
         
+        // replaces a null or loopback port with the backend's
+        void useBackend()
+        {
+            nullPort = false;
+            loopback.reset();
+            packs = midiOut && midiOut->getCurrentApi() == RtMidi::LINUX_ALSA;
+        }
+        
         bool openPort(unsigned int p)
         {
+            useBackend();
+            resetState();
             if (port != -1)
                 closePort();
             
@@ -80,8 +293,493 @@ namespace Lab {
             return port != -1;
         }
         
+        // messages are built in stack buffers, and passed to RtMidi by
+        // pointer and size, so that sending never allocates. The caller and
+        // the output thread both write, so write, suppress, and send must
+        // be called with writeMutex held.
+        void write(const unsigned char* message, size_t size)
+        {
+            if (loopback)
+                loopback->send(message, size);
+            else if (!nullPort)
+                midiOut->sendMessage(message, size);
+        }
+        
+        // The filter is applied where messages are written, under the same
+        // lock, so that the state it tracks is the order the device
+        // receives them in. A forced message is never suppressed, but
+        // still updates the state.
+        bool suppress(const MidiCommand& mc, bool force)
+        {
+            if (!filtering.load(std::memory_order_relaxed))
+                return false;
+            if (forget.load(std::memory_order_relaxed) && forget.exchange(false))
+                state.reset();
+            if (!state.redundant(mc) || force)
+                return false;
+            filtered.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        
+        // returns false if nothing was sent
+        bool send(const MidiCommand* mc, bool force = false)
+        {
+            size_t size = messageSize(mc->command);
+            if (!size || suppress(*mc, force))
+                return false;
+            unsigned char message[3] = { mc->command, mc->byte1, mc->byte2 };
+            write(message, size);
+            return true;
+        }
+        
+        // Immediate sends go through the output thread while pacing, so
+        // that they are paced along with scheduled messages
+        void submit(const MidiCommand& mc, bool force = false)
+        {
+            if (!pacing.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(writeMutex);
+                send(&mc, force);
+            }
+            else if (!schedule(monotonicNanoseconds(), mc, force))
+                pacedDropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        void resetState()
+        {
+            forget = true;
+        }
+        
+        bool sendSysEx(const uint8_t* data, size_t size, const MidiSysExOptions& options)
+        {
+            int64_t nsPerByte = options.bytesPerSecond > 0 ? 1000000000 / options.bytesPerSecond : 0;
+            MidiSysExProgress progress;
+            progress.totalBytes = size;
+            int64_t start = monotonicNanoseconds();
+            int64_t next = start;
+            bool ok = true;
+            
+            size_t i = 0;
+            while (i < size) {
+                if (data[i] != MIDI_SYSTEM_EXCLUSIVE) {
+                    ok = false;
+                    ++i;
+                    continue;
+                }
+                
+                // realtime bytes may appear within SysEx, other status
+                // bytes end it
+                size_t end = i + 1;
+                while (end < size && (data[end] < 0x80 || data[end] >= MIDI_TIME_CLOCK))
+                    ++end;
+                if (end == size || data[end] != MIDI_EOX) {
+                    ok = false;
+                    i = end;
+                    continue;
+                }
+                ++end;
+                
+                if (next > monotonicNanoseconds())
+                    sleepUntilNanoseconds(next);
+                int64_t sent;
+                {
+                    std::unique_lock<std::mutex> lock(writeMutex);
+                    sent = claimWire(lock, end - i);
+                    write(data + i, end - i);
+                }
+                next = sent + std::max(options.messageGapNs, int64_t(end - i) * nsPerByte);
+                i = end;
+                
+                if (options.progress) {
+                    progress.bytesSent = i;
+                    ++progress.messagesSent;
+                    progress.elapsedNs = monotonicNanoseconds() - start;
+                    progress.bytesPerSecond = progress.elapsedNs > 0 ?
+                        double(i) * 1.0e9 / double(progress.elapsedNs) : 0.;
+                    if (!options.progress(options.userData, &progress))
+                        return false;
+                }
+            }
+            return ok;
+        }
+        
+        // While pacing, a SysEx message waits, as a paced message would,
+        // until the modelled wire has room for it, and then occupies the
+        // wire for its length, so that paced messages queue behind it.
+        // Returns the time the message may be written.
+        int64_t claimWire(std::unique_lock<std::mutex>& lock, size_t size)
+        {
+            int64_t now = monotonicNanoseconds();
+            int64_t nsPerByte = pacing.load(std::memory_order_relaxed);
+            if (!nsPerByte)
+                return now;
+            while (wireFreeNs - now >= kPacingBacklogNs) {
+                int64_t until = wireFreeNs - kPacingBacklogNs;
+                lock.unlock();
+                sleepUntilNanoseconds(until);
+                lock.lock();
+                now = monotonicNanoseconds();
+            }
+            wireFreeNs = std::max(wireFreeNs, now) + int64_t(size) * nsPerByte;
+            return now;
+        }
+        
+        void resetPacingStats()
+        {
+            pacedMessages = 0;
+            pacedDelayed = 0;
+            pacedDropped = 0;
+            pacedTotalDelayNs = 0;
+            pacedMaxDelayNs = 0;
+        }
+        
+        // A batch is packed into one buffer, and written in one call,
+        // only where the backend accepts a buffer of several messages.
+        // ALSA encodes each message in the buffer as a sequencer event,
+        // understands running status, and drains its output once per
+        // call. CoreMIDI, JACK, and WinMM take a single message per call.
+        // The packer holds the write lock for its lifetime.
+        //
+        class Packer {
+        public:
+            explicit Packer(Detail* detail)
+            : lock(detail->writeMutex)
+            , detail(detail)
+            , size(0)
+            , running(0)
+            {
+            }
+            
+            ~Packer() { flush(); }
+            
+            void add(const MidiCommand& mc, bool force = false)
+            {
+                if (!detail->packs) {
+                    detail->send(&mc, force);
+                    return;
+                }
+                
+                size_t n = messageSize(mc.command);
+                if (!n || detail->suppress(mc, force))
+                    return;
+                if (size + n > sizeof(buffer))
+                    flush();
+                
+                // realtime messages may be interleaved without affecting
+                // running status, but system common messages cancel it
+                const unsigned char bytes[3] = { mc.command, mc.byte1, mc.byte2 };
+                size_t first = 0;
+                if (mc.command < MIDI_SYSTEM_EXCLUSIVE) {
+                    if (mc.command == running)
+                        first = 1;
+                    running = mc.command;
+                }
+                else if (mc.command < MIDI_TIME_CLOCK)
+                    running = 0;
+                for (size_t i = first; i < n; ++i)
+                    buffer[size++] = bytes[i];
+            }
+            
+            void flush()
+            {
+                if (size)
+                    detail->write(buffer, size);
+                size = 0;
+                running = 0;
+            }
+            
+        private:
+            std::lock_guard<std::mutex> lock;
+            Detail* detail;
+            unsigned char buffer[256];
+            size_t size;
+            uint8_t running;
+        };
+        
+        // Scheduled messages pass through a wait-free ring to the output
+        // thread, which keeps them in a heap ordered by time, then by the
+        // order they were scheduled in, so that simultaneous messages,
+        // such as a note off and a note on of the same note, keep their
+        // order. The thread sleeps until the earliest is due, on an
+        // absolute deadline, and sends everything due as one batch.
+        //
+        struct Scheduled {
+            int64_t timeNs;
+            uint64_t seq;
+            MidiCommand command;
+            bool urgent;
+            bool force;
+        };
+        
+        static bool later(const Scheduled& a, const Scheduled& b)
+        {
+            return a.timeNs != b.timeNs ? a.timeNs > b.timeNs : a.seq > b.seq;
+        }
+        
+        bool schedule(int64_t timeNs, const MidiCommand& mc, bool force = false)
+        {
+            if (!incoming)
+                startScheduler();
+            Scheduled s;
+            s.timeNs = timeNs;
+            s.seq = nextSeq;
+            s.command = mc;
+            s.urgent = false;
+            s.force = force;
+            if (!incoming->push(s))
+                return false;
+            ++nextSeq;
+            
+            // pairs with the fence in run, as in MidiInQueue
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (waiting.load(std::memory_order_relaxed)) {
+                std::lock_guard<std::mutex> lock(mutex);
+                signal.notify_one();
+            }
+            return true;
+        }
+        
+        void startScheduler()
+        {
+            incoming.reset(new SpscRing<Scheduled>(kScheduleCapacity));
+            heap.reserve(incoming->capacity());
+            ready.reserve(incoming->capacity());
+            quit = false;
+            thread = std::thread(&Detail::run, this);
+        }
+        
+        // wakes the output thread to act on a change of pacing, or a clear
+        void kick()
+        {
+            if (!thread.joinable())
+                return;
+            std::lock_guard<std::mutex> lock(mutex);
+            kicked = true;
+            signal.notify_one();
+        }
+        
+        void stopScheduler()
+        {
+            if (!thread.joinable())
+                return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+                signal.notify_one();
+            }
+            thread.join();
+        }
+        
+        // With pacing, due messages wait in a second heap, ready, until
+        // the modelled wire has room for them. Note offs and realtime
+        // messages jump ahead of the rest, except that a note off never
+        // overtakes a waiting note on of the same note, which would leave
+        // the note hanging.
+        //
+        static bool isNoteOn(const MidiCommand& mc)
+        {
+            return (mc.command & 0xf0) == MIDI_NOTE_ON && mc.byte2;
+        }
+        
+        static bool isNoteOff(const MidiCommand& mc)
+        {
+            uint8_t type = mc.command & 0xf0;
+            return type == MIDI_NOTE_OFF || (type == MIDI_NOTE_ON && !mc.byte2);
+        }
+        
+        bool isUrgent(const MidiCommand& mc) const
+        {
+            if (mc.command >= MIDI_TIME_CLOCK)
+                return true;
+            return isNoteOff(mc) && !notesWaiting[mc.command & 0xf][mc.byte1 & 0x7f];
+        }
+        
+        static bool lessUrgent(const Scheduled& a, const Scheduled& b)
+        {
+            return a.urgent != b.urgent ? b.urgent : a.seq > b.seq;
+        }
+        
+        void makeReady(const Scheduled& s)
+        {
+            Scheduled r = s;
+            r.urgent = isUrgent(s.command);
+            if (isNoteOn(s.command))
+                ++notesWaiting[s.command.command & 0xf][s.command.byte1 & 0x7f];
+            ready.push_back(r);
+            std::push_heap(ready.begin(), ready.end(), lessUrgent);
+        }
+        
+        Scheduled takeReady()
+        {
+            std::pop_heap(ready.begin(), ready.end(), lessUrgent);
+            Scheduled r = ready.back();
+            ready.pop_back();
+            if (isNoteOn(r.command))
+                --notesWaiting[r.command.command & 0xf][r.command.byte1 & 0x7f];
+            return r;
+        }
+        
+        // Sends ready messages while the wire has room, and returns when
+        // the next may be sent. The interface is assumed to buffer at least
+        // kPacingBacklogNs of bytes, so a message may be handed over while
+        // the one before it is still on the wire.
+        //
+        int64_t pace(int64_t now, int64_t nsPerByte)
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            while (!ready.empty() && wireFreeNs - now < kPacingBacklogNs) {
+                Scheduled r = takeReady();
+                size_t size = messageSize(r.command.command);
+                if (!size || suppress(r.command, r.force))
+                    continue;
+                
+                // only a message that found the wire busy is delayed by
+                // pacing, rather than by the thread's own wakeup latency
+                int64_t start = std::max(wireFreeNs, now);
+                int64_t delay = wireFreeNs > r.timeNs ? start - r.timeNs : 0;
+                wireFreeNs = start + int64_t(size) * nsPerByte;
+                
+                pacedMessages.fetch_add(1, std::memory_order_relaxed);
+                if (delay > 0) {
+                    pacedDelayed.fetch_add(1, std::memory_order_relaxed);
+                    pacedTotalDelayNs.fetch_add(delay, std::memory_order_relaxed);
+                    if (delay > pacedMaxDelayNs.load(std::memory_order_relaxed))
+                        pacedMaxDelayNs.store(delay, std::memory_order_relaxed);
+                }
+                
+                // written once counted, so the stats include every message
+                // a receiver has seen
+                const unsigned char message[3] = { r.command.command, r.command.byte1, r.command.byte2 };
+                write(message, size);
+            }
+            return ready.empty() ? kNever : wireFreeNs - kPacingBacklogNs;
+        }
+        
+        // Discards the messages scheduled before seq c, except note offs,
+        // which are made due now, so that clearing never leaves a note
+        // hanging. A note off whose note on was discarded is harmless.
+        void clear(uint64_t c, int64_t now)
+        {
+            auto discard = [c](const Scheduled& s) { return s.seq < c && !isNoteOff(s.command); };
+            heap.erase(std::remove_if(heap.begin(), heap.end(), discard), heap.end());
+            for (Scheduled& s : heap)
+                if (s.seq < c)
+                    s.timeNs = std::min(s.timeNs, now);
+            std::make_heap(heap.begin(), heap.end(), later);
+            
+            std::vector<Scheduled>::iterator i = ready.begin();
+            while (i != ready.end()) {
+                if (discard(*i)) {
+                    if (isNoteOn(i->command))
+                        --notesWaiting[i->command.command & 0xf][i->command.byte1 & 0x7f];
+                    i = ready.erase(i);
+                }
+                else
+                    ++i;
+            }
+            
+            // a note off held behind a discarded note on may now go ahead
+            for (Scheduled& r : ready)
+                r.urgent = isUrgent(r.command);
+            std::make_heap(ready.begin(), ready.end(), lessUrgent);
+        }
+        
+        void run()
+        {
+            uint64_t cleared = 0;
+            while (!quit.load()) {
+                Scheduled s;
+                while (heap.size() < heap.capacity() && incoming->pop(s)) {
+                    heap.push_back(s);
+                    std::push_heap(heap.begin(), heap.end(), later);
+                }
+                
+                int64_t now = monotonicNanoseconds();
+                uint64_t c = clearBefore.load(std::memory_order_acquire);
+                if (c != cleared) {
+                    cleared = c;
+                    clear(c, now);
+                }
+                
+                int64_t nsPerByte = pacing.load(std::memory_order_relaxed);
+                int64_t wake = kNever;
+                if (nsPerByte) {
+                    while (!heap.empty() && heap.front().timeNs <= now && ready.size() < ready.capacity()) {
+                        std::pop_heap(heap.begin(), heap.end(), later);
+                        makeReady(heap.back());
+                        heap.pop_back();
+                    }
+                    wake = pace(now, nsPerByte);
+                }
+                else {
+                    // pacing was turned off, so anything still waiting goes now
+                    Packer packer(this);
+                    while (!ready.empty()) {
+                        Scheduled r = takeReady();
+                        packer.add(r.command, r.force);
+                    }
+                    while (!heap.empty() && heap.front().timeNs <= now) {
+                        std::pop_heap(heap.begin(), heap.end(), later);
+                        packer.add(heap.back().command, heap.back().force);
+                        heap.pop_back();
+                    }
+                }
+                
+                // a message that is due but waiting for room in ready is
+                // taken when pace makes room
+                if (!heap.empty() && heap.front().timeNs > now)
+                    wake = std::min(wake, heap.front().timeNs);
+                
+                // Sleep until the next message is due, or until another is
+                // scheduled, which may be due sooner
+                auto woken = [this] {
+                    return quit.load() || kicked || (!incoming->empty() && heap.size() < heap.capacity());
+                };
+                std::unique_lock<std::mutex> lock(mutex);
+                waiting.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (wake == kNever)
+                    signal.wait(lock, woken);
+                else {
+                    using namespace std::chrono;
+                    signal.wait_until(lock, steady_clock::time_point(
+                        duration_cast<steady_clock::duration>(nanoseconds(wake))), woken);
+                }
+                waiting.store(false, std::memory_order_relaxed);
+                kicked = false;
+            }
+        }
+        
         RtMidiOut* midiOut;
         unsigned int port;
+        bool nullPort;
+        bool packs;
+        std::unique_ptr<MidiLoopbackOut> loopback;
+        std::mutex writeMutex;
+        
+        std::unique_ptr<SpscRing<Scheduled>> incoming;
+        std::vector<Scheduled> heap;        // output thread only
+        std::vector<Scheduled> ready;       // output thread only
+        uint16_t notesWaiting[16][128];     // note ons in ready
+        int64_t wireFreeNs;                 // when the modelled wire is idle, guarded by writeMutex
+        std::atomic<int64_t> pacing;        // nanoseconds per byte, or zero
+        std::atomic<uint64_t> pacedMessages;
+        std::atomic<uint64_t> pacedDelayed;
+        std::atomic<uint64_t> pacedDropped;
+        std::atomic<int64_t> pacedTotalDelayNs;
+        std::atomic<int64_t> pacedMaxDelayNs;
+        
+        ChannelState state;                 // guarded by writeMutex
+        std::atomic<bool> filtering;
+        std::atomic<bool> forget;
+        std::atomic<uint64_t> filtered;
+        uint64_t nextSeq;                   // scheduling thread only
+        std::atomic<uint64_t> clearBefore;
+        std::thread thread;
+        std::atomic<bool> quit;
+        std::atomic<bool> waiting;
+        bool kicked;                        // guarded by mutex
+        std::mutex mutex;
+        std::condition_variable signal;
     };
     
     MidiOut::MidiOut()
@@ -103,6 +801,8 @@ namespace Lab {
     {
         try {
             _detail->midiOut->openVirtualPort(_port);
+            _detail->useBackend();
+            _detail->resetState();
         }
         catch(const RtMidiError&) {
             return false;
@@ -110,6 +810,25 @@ namespace Lab {
         return true;
     }
 
+    bool MidiOut::openNullPort()
+    {
+        _detail->nullPort = true;
+        _detail->loopback.reset();
+        _detail->resetState();
+        return true;
+    }
+
+    bool MidiOut::openLoopbackPort(MidiIn* in)
+    {
+        if (!in)
+            return false;
+        _detail->nullPort = false;
+        _detail->loopback.reset(new MidiLoopbackOut(in));
+        _detail->packs = false;     // the input expects whole messages
+        _detail->resetState();
+        return true;
+    }
+
     void MidiOut::closePort()
     {
         _detail->closePort();
@@ -122,57 +841,147 @@ namespace Lab {
 
     void MidiOut::sendNoteOn(int channel, int id, int value)
     {
-        std::vector<unsigned char> message;
-        message.push_back(MIDI_NOTE_ON | channel);
-        message.push_back(id);
-        message.push_back(value);
-        _detail->midiOut->sendMessage(&message);
+        _detail->submit(MidiCommand(uint8_t(MIDI_NOTE_ON | channel), uint8_t(id), uint8_t(value)));
     }
 
     void MidiOut::sendNoteOff(int channel, int id, int value)
     {
-        std::vector<unsigned char> message;
-        message.push_back(MIDI_NOTE_OFF | channel);
-        message.push_back(id);
-        message.push_back(value);
-        _detail->midiOut->sendMessage(&message);
+        _detail->submit(MidiCommand(uint8_t(MIDI_NOTE_OFF | channel), uint8_t(id), uint8_t(value)));
     }
 
     void MidiOut::sendControlChange(int channel, int id, int value)
     {
-        std::vector<unsigned char> message;
-        message.push_back(MIDI_CONTROL_CHANGE | channel);
-        message.push_back(id);
-        message.push_back(value);
-        _detail->midiOut->sendMessage(&message);
+        _detail->submit(MidiCommand(uint8_t(MIDI_CONTROL_CHANGE | channel), uint8_t(id), uint8_t(value)));
     }
 
     void MidiOut::sendProgramChange(int channel, int value)
     {
-        std::vector<unsigned char> message;
-        message.push_back(MIDI_PROGRAM_CHANGE | channel);
-        message.push_back(value);
-        _detail->midiOut->sendMessage(&message);
+        _detail->submit(MidiCommand(uint8_t(MIDI_PROGRAM_CHANGE | channel), uint8_t(value), 0));
     }
 
     void MidiOut::sendPitchBend(int channel, int lsb, int msb)
     {
-        std::vector<unsigned char> message;
-        message.push_back(MIDI_PITCH_BEND | channel);
-        message.push_back(lsb);
-        message.push_back(msb);
-        _detail->midiOut->sendMessage(&message);
+        _detail->submit(MidiCommand(uint8_t(MIDI_PITCH_BEND | channel), uint8_t(lsb), uint8_t(msb)));
     }
     
     void MidiOut::command(const MidiCommand* mc)
     {
-        std::vector<unsigned char> message;
-        message.push_back(mc->command);
-        message.push_back(mc->byte1);
-        uint8_t c = mc->command >> 4;
-        if ((c != 0xc) && (c != 0xd))
-            message.push_back(mc->byte2);
-        _detail->midiOut->sendMessage(&message);
+        _detail->submit(*mc);
+    }
+    
+    void MidiOut::send(const MidiCommand* mc, size_t count)
+    {
+        if (_detail->pacing.load(std::memory_order_relaxed)) {
+            for (size_t i = 0; i < count; ++i)
+                _detail->submit(mc[i]);
+            return;
+        }
+        Detail::Packer packer(_detail);
+        for (size_t i = 0; i < count; ++i)
+            packer.add(mc[i]);
+    }
+    
+    void MidiOut::resend(const MidiCommand* mc)
+    {
+        _detail->submit(*mc, true);
+    }
+    
+    void MidiOut::setFilterRedundant(bool filter)
+    {
+        _detail->resetState();
+        _detail->filtering.store(filter, std::memory_order_relaxed);
+    }
+    
+    bool MidiOut::filterRedundant() const
+    {
+        return _detail->filtering.load(std::memory_order_relaxed);
+    }
+    
+    void MidiOut::resetFilter()
+    {
+        _detail->resetState();
+    }
+    
+    uint64_t MidiOut::filteredCount() const
+    {
+        return _detail->filtered.load(std::memory_order_relaxed);
+    }
+    
+    bool MidiOut::sendAt(int64_t timeNs, const MidiCommand& mc)
+    {
+        return _detail->schedule(timeNs, mc);
+    }
+    
+    size_t MidiOut::sendAt(const MidiRtEvent* ev, size_t count, int64_t originNs)
+    {
+        size_t i = 0;
+        for (; i < count; ++i)
+            if (!_detail->schedule(originNs + ev[i].timeNs, ev[i].command))
+                break;
+        return i;
+    }
+    
+    void MidiOut::clearScheduled()
+    {
+        _detail->clearBefore.store(_detail->nextSeq, std::memory_order_release);
+        _detail->kick();
+    }
+    
+    bool MidiOut::sendSysEx(const uint8_t* data, size_t size, const MidiSysExOptions& options)
+    {
+        return _detail->sendSysEx(data, size, options);
+    }
+    
+    bool MidiOut::sendSysExFile(const char* path, const MidiSysExOptions& options)
+    {
+        MappedFile file(path);
+        if (!file.data)
+            return false;
+        return _detail->sendSysEx(file.data, file.size, options);
+    }
+    
+    void MidiOut::setPacing(int bytesPerSecond)
+    {
+        int64_t nsPerByte = bytesPerSecond > 0 ? (1000000000 + bytesPerSecond - 1) / bytesPerSecond : 0;
+        if (nsPerByte && !_detail->incoming)
+            _detail->startScheduler();
+        _detail->pacing.store(nsPerByte, std::memory_order_relaxed);
+        _detail->kick();
+    }
+    
+    int MidiOut::pacing() const
+    {
+        int64_t nsPerByte = _detail->pacing.load(std::memory_order_relaxed);
+        return nsPerByte ? int(1000000000 / nsPerByte) : 0;
+    }
+    
+    MidiOutPacingStats MidiOut::pacingStats() const
+    {
+        MidiOutPacingStats s;
+        s.messages = _detail->pacedMessages.load(std::memory_order_relaxed);
+        s.delayed = _detail->pacedDelayed.load(std::memory_order_relaxed);
+        s.dropped = _detail->pacedDropped.load(std::memory_order_relaxed);
+        s.maxDelayNs = _detail->pacedMaxDelayNs.load(std::memory_order_relaxed);
+        if (s.delayed)
+            s.meanDelayNs = _detail->pacedTotalDelayNs.load(std::memory_order_relaxed) / int64_t(s.delayed);
+        return s;
+    }
+    
+    void MidiOut::resetPacingStats()
+    {
+        _detail->resetPacingStats();
+    }
+    
+    void MidiOut::events(const MidiRtEvent* ev, size_t count)
+    {
+        if (_detail->pacing.load(std::memory_order_relaxed)) {
+            for (size_t i = 0; i < count; ++i)
+                _detail->submit(ev[i].command);
+            return;
+        }
+        Detail::Packer packer(_detail);
+        for (size_t i = 0; i < count; ++i)
+            packer.add(ev[i].command);
     }
     
     void MidiOut::playerCallback(void* userData, MidiRtEvent* ev)
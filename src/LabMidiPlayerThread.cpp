@@ -0,0 +1,180 @@
+//
+//  LabMidiPlayerThread.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#include "LabMidi/PlayerThread.h"
+#include "LabMidi/MidiFilePlayer.h"
+#include "LabMidi/Scheduler.h"
+#include "LabMidi/Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+#include <thread>
+
+namespace Lab {
+
+    // The longest the thread sleeps in one go, so that stop() is noticed
+    // promptly even when the next event is far away.
+    //
+    static const int64_t kMaxSleepNs = 10000000;
+
+    class MidiPlayerThread::Detail
+    {
+    public:
+        Detail(MidiSongPlayer* p, MidiScheduler* s)
+        : player(p)
+        , scheduler(s)
+        , spinNs(0)
+        , startNs(0)
+        , quit(false)
+        , active(false)
+        {
+            resetStats();
+        }
+
+        ~Detail()
+        {
+            stop();
+        }
+
+        void start(int64_t spin)
+        {
+            stop();
+            if (!player && !scheduler)
+                return;
+
+            spinNs = std::max(int64_t(0), spin);
+            quit = false;
+            active = true;
+            startNs = monotonicNanoseconds();
+            if (player)
+                player->playNs(0);
+            thread = std::thread(&Detail::run, this);
+        }
+
+        void stop()
+        {
+            quit = true;
+            if (thread.joinable())
+                thread.join();
+            active = false;
+        }
+
+        // The player is updated on every wakeup, not just when an event is
+        // due, so that commands posted to it while it is stopped are seen.
+        //
+        void run()
+        {
+            int64_t now = monotonicNanoseconds();
+            while (!quit) {
+                int64_t t = now - startNs;
+                int64_t nextEventTime;
+                if (player) {
+                    player->updateNs(t);
+                    if (player->atEnd())
+                        break;
+                    nextEventTime = player->nextEventTimeNs();
+                }
+                else {
+                    scheduler->updateNs(t);
+                    nextEventTime = scheduler->nextEventTimeNs();
+                }
+
+                bool due = nextEventTime != std::numeric_limits<int64_t>::max();
+                int64_t deadline = due ? startNs + nextEventTime : now + kMaxSleepNs;
+                int64_t wake = std::min(deadline - spinNs, now + kMaxSleepNs);
+                if (wake > now)
+                    sleepUntilNanoseconds(wake);
+
+                wakeups.fetch_add(1, std::memory_order_relaxed);
+
+                now = monotonicNanoseconds();
+                if (!due || now < deadline - spinNs)
+                    continue; // woke up to check for commands, nothing is due yet
+
+                while (now < deadline)
+                    now = monotonicNanoseconds();
+
+                int64_t lateness = now - deadline;
+                dispatches.fetch_add(1, std::memory_order_relaxed);
+                totalLatenessNs.fetch_add(lateness, std::memory_order_relaxed);
+                if (lateness > maxLatenessNs.load(std::memory_order_relaxed))
+                    maxLatenessNs.store(lateness, std::memory_order_relaxed);
+            }
+            active = false;
+        }
+
+        void resetStats()
+        {
+            wakeups = 0;
+            dispatches = 0;
+            totalLatenessNs = 0;
+            maxLatenessNs = 0;
+        }
+
+        MidiSongPlayer* player;
+        MidiScheduler* scheduler;
+        int64_t spinNs;
+        int64_t startNs;
+        std::atomic<bool> quit;
+        std::atomic<bool> active;
+        std::thread thread;
+
+        std::atomic<uint64_t> wakeups;
+        std::atomic<uint64_t> dispatches;
+        std::atomic<int64_t> totalLatenessNs;
+        std::atomic<int64_t> maxLatenessNs;
+    };
+
+    MidiPlayerThread::MidiPlayerThread(MidiSongPlayer* p)
+    : _detail(new Detail(p, nullptr))
+    {
+    }
+
+    MidiPlayerThread::MidiPlayerThread(MidiScheduler* s)
+    : _detail(new Detail(nullptr, s))
+    {
+    }
+
+    MidiPlayerThread::~MidiPlayerThread()
+    {
+        delete _detail;
+    }
+
+    void MidiPlayerThread::start(int64_t spinNs)
+    {
+        _detail->start(spinNs);
+    }
+
+    void MidiPlayerThread::stop()
+    {
+        _detail->stop();
+    }
+
+    bool MidiPlayerThread::running() const
+    {
+        return _detail->active;
+    }
+
+    MidiPlayerThreadStats MidiPlayerThread::stats() const
+    {
+        MidiPlayerThreadStats s;
+        s.wakeups = _detail->wakeups.load(std::memory_order_relaxed);
+        s.dispatches = _detail->dispatches.load(std::memory_order_relaxed);
+        s.maxLatenessNs = _detail->maxLatenessNs.load(std::memory_order_relaxed);
+        if (s.dispatches)
+            s.meanLatenessNs = _detail->totalLatenessNs.load(std::memory_order_relaxed) / int64_t(s.dispatches);
+        return s;
+    }
+
+    void MidiPlayerThread::resetStats()
+    {
+        _detail->resetStats();
+    }
+
+} // Lab
@@ -0,0 +1,210 @@
+//
+//  LabMidiRcu.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+namespace Lab {
+
+    // A list that is read far more often than it is written, such as a
+    // list of callbacks. The list is published as an immutable snapshot
+    // behind an atomic pointer, so reading it is wait-free, and any
+    // number of threads may read while others write.
+    //
+    // Writers are serialized by a mutex, and publish a modified copy. A
+    // retired snapshot may still be in use by a reader, so each snapshot
+    // counts its readers, and is freed by a later write once its count
+    // is zero, even if other reads are always in progress.
+    //
+    // A reader that sees an item just before it is removed may still use
+    // it once more. Call synchronize() after removing an item to wait until
+    // no other thread can be using it.
+    //
+    template <typename T>
+    class RcuList {
+    public:
+        typedef std::vector<T> List;
+        class Reader;
+
+    private:
+        struct Snapshot {
+            Snapshot(List&& list, uint64_t seq)
+            : list(std::move(list))
+            , seq(seq)
+            , refs(0)
+            {
+            }
+
+            const List list;
+            const uint64_t seq;                     // order of publication
+            mutable std::atomic<uint32_t> refs;     // readers holding it
+        };
+
+        // The innermost read in progress on this thread, of any list of
+        // this type. Each Reader links to the one it is nested within, so
+        // a reader may call synchronize() without waiting for itself.
+        static thread_local const Reader* top;
+
+    public:
+        RcuList()
+        : current(new Snapshot(List(), 0))
+        , entering(0)
+        , seq(0)
+        {
+        }
+
+        ~RcuList()
+        {
+            delete current.load();
+            for (auto r : retired)
+                delete r;
+        }
+
+        // Holds a snapshot of the list for as long as the reader exists
+        class Reader {
+        public:
+            explicit Reader(const RcuList& rcu)
+            : rcu(rcu)
+            , outer(top)
+            {
+                rcu.entering.fetch_add(1);
+                snapshot = rcu.current.load();
+                snapshot->refs.fetch_add(1);
+                rcu.entering.fetch_sub(1);
+                top = this;
+            }
+
+            ~Reader()
+            {
+                top = outer;
+                snapshot->refs.fetch_sub(1);
+            }
+
+            typename List::const_iterator begin() const { return snapshot->list.begin(); }
+            typename List::const_iterator end() const { return snapshot->list.end(); }
+            bool empty() const { return snapshot->list.empty(); }
+            size_t size() const { return snapshot->list.size(); }
+
+        private:
+            Reader(const Reader&) = delete;
+            Reader& operator=(const Reader&) = delete;
+
+            const RcuList& rcu;
+            const Snapshot* snapshot;
+            const Reader* outer;
+
+            friend class RcuList;
+        };
+
+        void add(const T& item)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            List l(current.load()->list);
+            l.push_back(item);
+            publish(std::move(l));
+        }
+
+        // removes every item matching pred, in one pass
+        template <typename Pred>
+        void removeIf(Pred pred)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            const List& c = current.load()->list;
+            if (std::none_of(c.begin(), c.end(), pred))
+                return;
+            List l;
+            l.reserve(c.size());
+            for (const T& item : c)
+                if (!pred(item))
+                    l.push_back(item);
+            publish(std::move(l));
+        }
+
+        // Waits until every read that began before the call has finished,
+        // so an item removed beforehand is no longer in use. Reads held by
+        // the calling thread are not waited for, so a reader may remove an
+        // item and synchronize, although it may still use what it has.
+        //
+        void synchronize()
+        {
+            uint64_t before;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                before = current.load()->seq;
+            }
+            for (;;) {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (reclaim()) {
+                        bool busy = false;
+                        for (auto r : retired)
+                            if (r->seq < before && r->refs.load() > held(r))
+                                busy = true;
+                        if (!busy)
+                            return;
+                    }
+                }
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+        // A reader counts itself as entering before loading the pointer,
+        // and holds the snapshot before it stops entering. A writer
+        // replaces the pointer before checking for entering readers, so
+        // if there are none, any reader of a retired snapshot already
+        // holds it, and any later reader will see the new pointer.
+        // Returns false if a reader was entering, and nothing was freed.
+        bool reclaim()
+        {
+            if (entering.load() != 0)
+                return false;
+            size_t kept = 0;
+            for (auto r : retired) {
+                if (r->refs.load() == 0)
+                    delete r;
+                else
+                    retired[kept++] = r;
+            }
+            retired.resize(kept);
+            return true;
+        }
+
+        void publish(List&& l)
+        {
+            retired.push_back(current.exchange(new Snapshot(std::move(l), ++seq)));
+            reclaim();
+        }
+
+        // the number of reads of a snapshot held by the calling thread
+        static uint32_t held(const Snapshot* snapshot)
+        {
+            uint32_t count = 0;
+            for (const Reader* r = top; r; r = r->outer)
+                if (r->snapshot == snapshot)
+                    ++count;
+            return count;
+        }
+
+        std::atomic<const Snapshot*> current;
+        mutable std::atomic<uint32_t> entering;
+        std::mutex mutex;
+        uint64_t seq;                       // guarded by mutex
+        std::vector<const Snapshot*> retired;   // guarded by mutex
+    };
+
+    template <typename T>
+    thread_local const typename RcuList<T>::Reader* RcuList<T>::top = nullptr;
+
+} // Lab
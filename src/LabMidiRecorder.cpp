@@ -0,0 +1,253 @@
+//
+//  LabMidiRecorder.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#include "LabMidi/Recorder.h"
+#include "LabMidi/MidiFile.h"
+#include "LabMidi/MidiInOut.h"
+#include "LabMidi/Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <memory>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace Lab {
+
+    class MidiRecorder::Detail
+    {
+    public:
+        // Messages of three bytes or less are stored in the record, longer
+        // ones in the SysEx pool
+        //
+        struct Record {
+            int64_t timeNs;
+            uint32_t size;
+            uint32_t sysexOffset;
+            uint8_t bytes[3];
+        };
+
+        Detail(size_t chunkSize, size_t chunkCount, size_t sysexCapacity)
+        : chunkSize(chunkSize ? chunkSize : 1)
+        , sysex(sysexCapacity)
+        , sysexUsed(0)
+        , startNs(0)
+        , input(nullptr)
+        , count(0)
+        , dropped(0)
+        , active(false)
+        , busy(false)
+        {
+            chunks.resize(chunkCount);
+            for (auto& c : chunks)
+                c.reset(new Record[this->chunkSize]);
+        }
+
+        static void recordCallback(void* userData, const MidiInMessage* msg)
+        {
+            ((MidiRecorder::Detail*) userData)->record(*msg);
+        }
+
+        void start()
+        {
+            stop();
+            count.store(0, std::memory_order_relaxed);
+            dropped.store(0, std::memory_order_relaxed);
+            sysexUsed = 0;
+            startNs = monotonicNanoseconds();
+            active.store(true);
+        }
+
+        // busy and active form a handshake, so that once stop has seen
+        // the recording thread outside of record, it won't enter again
+        void stop()
+        {
+            active.store(false);
+            while (busy.load())
+                std::this_thread::yield();
+        }
+
+        void record(const MidiInMessage& msg)
+        {
+            busy.store(true);
+            if (active.load() && msg.size > 0 && msg.data[0] < MIDI_TIME_CLOCK)
+                capture(msg);
+            busy.store(false, std::memory_order_release);
+        }
+
+        void capture(const MidiInMessage& msg)
+        {
+            size_t n = count.load(std::memory_order_relaxed);
+            if (n / chunkSize >= chunks.size()) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            Record& r = chunks[n / chunkSize][n % chunkSize];
+            r.timeNs = std::max(int64_t(0), msg.arrivalNs - startNs);
+            r.size = uint32_t(msg.size);
+            r.sysexOffset = 0;
+            if (msg.size <= sizeof(r.bytes))
+                memcpy(r.bytes, msg.data, msg.size);
+            else {
+                if (sysexUsed + msg.size > sysex.size()) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                r.sysexOffset = uint32_t(sysexUsed);
+                memcpy(&sysex[sysexUsed], msg.data, msg.size);
+                sysexUsed += msg.size;
+            }
+            count.store(n + 1, std::memory_order_release);
+        }
+
+        const Record& record(size_t i) const
+        {
+            return chunks[i / chunkSize][i % chunkSize];
+        }
+
+        const uint8_t* data(const Record& r) const
+        {
+            return r.size <= sizeof(r.bytes) ? r.bytes : &sysex[r.sysexOffset];
+        }
+
+        void buildSong(MidiSong& song, float beatsPerMinute, int ticksPerBeat) const
+        {
+            song.clearTracks();
+            song.startingTempo = beatsPerMinute;
+            song.ticksPerBeat = float(ticksPerBeat);
+
+            double ticksPerNanosecond = double(ticksPerBeat) * double(beatsPerMinute) / 60.0e9;
+
+            // the first track holds the tempo, and non channel messages
+            std::shared_ptr<MidiTrack> tracks[17];
+            int64_t lastTick[17] = { 0 };
+            tracks[0] = std::make_shared<MidiTrack>();
+            Event_SetTempo* tempo = new Event_SetTempo();
+            tempo->microsecondsPerBeat = int(std::lround(60000000.0 / double(beatsPerMinute)));
+            tracks[0]->events.push_back(tempo);
+
+            size_t n = count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; ++i) {
+                const Record& r = record(i);
+                const uint8_t* d = data(r);
+                uint8_t status = d[0];
+
+                MidiEvent* ev;
+                int t = 0;
+                if (status < 0xf0) {
+                    t = 1 + (status & 0x0f);
+                    ev = new Event_Channel();
+                    ev->data = { status, r.size > 1 ? d[1] : uint8_t(0), r.size > 2 ? d[2] : uint8_t(0xff) };
+                }
+                else if (status == 0xf0) {
+                    ev = new Event_SysEx();
+                    ev->data.assign(d + 1, d + r.size);
+                }
+                else {
+                    // other system messages are stored as raw bytes, which
+                    // is what a Standard MIDI File's F7 escape is for
+                    ev = new Event_DividedSysEx();
+                    ev->data.assign(d, d + r.size);
+                }
+
+                if (!tracks[t])
+                    tracks[t] = std::make_shared<MidiTrack>();
+                int64_t tick = std::llround(double(r.timeNs) * ticksPerNanosecond);
+                ev->tick = int(std::max(int64_t(0), tick - lastTick[t]));
+                lastTick[t] = std::max(tick, lastTick[t]);
+                tracks[t]->events.push_back(ev);
+            }
+
+            for (int t = 0; t < 17; ++t)
+                if (tracks[t]) {
+                    tracks[t]->events.push_back(new Event_EndOfTrack());
+                    song.tracks.push_back(tracks[t]);
+                }
+        }
+
+        size_t chunkSize;
+        std::vector<std::unique_ptr<Record[]>> chunks;
+        std::vector<uint8_t> sysex;
+        size_t sysexUsed;
+        int64_t startNs;
+        MidiIn* input;      // the attached input, if any
+
+        std::atomic<size_t> count;
+        std::atomic<uint64_t> dropped;
+        std::atomic<bool> active;
+        std::atomic<bool> busy;
+    };
+
+    MidiRecorder::MidiRecorder(size_t chunkSize, size_t chunkCount, size_t sysexCapacity)
+    : _detail(new Detail(chunkSize, chunkCount, sysexCapacity))
+    {
+    }
+
+    MidiRecorder::~MidiRecorder()
+    {
+        detach(_detail->input);
+        _detail->stop();
+        delete _detail;
+    }
+
+    void MidiRecorder::attach(MidiIn* in)
+    {
+        if (!in || in == _detail->input)
+            return;
+        detach(_detail->input);
+        in->addMessageCallback(&Detail::recordCallback, _detail);
+        _detail->input = in;
+    }
+
+    void MidiRecorder::detach(MidiIn* in)
+    {
+        if (!in || in != _detail->input)
+            return;
+        in->removeMessageCallback(_detail);
+        _detail->input = nullptr;
+    }
+
+    void MidiRecorder::start()
+    {
+        _detail->start();
+    }
+
+    void MidiRecorder::stop()
+    {
+        _detail->stop();
+    }
+
+    bool MidiRecorder::recording() const
+    {
+        return _detail->active.load();
+    }
+
+    void MidiRecorder::record(const MidiInMessage& msg)
+    {
+        _detail->record(msg);
+    }
+
+    size_t MidiRecorder::messageCount() const
+    {
+        return _detail->count.load(std::memory_order_relaxed);
+    }
+
+    uint64_t MidiRecorder::droppedCount() const
+    {
+        return _detail->dropped.load(std::memory_order_relaxed);
+    }
+
+    void MidiRecorder::buildSong(MidiSong& song, float beatsPerMinute, int ticksPerBeat) const
+    {
+        _detail->buildSong(song, beatsPerMinute, ticksPerBeat);
+    }
+
+} // Lab
@@ -0,0 +1,119 @@
+//
+//  LabMidiRing.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <vector>
+
+namespace Lab {
+
+    // A wait-free single producer, single consumer ring buffer. One thread
+    // may push and one other thread may pop; neither ever blocks. The
+    // storage is allocated up front, so neither side allocates either.
+    //
+    template <typename T>
+    class SpscRing {
+    public:
+        // capacity is rounded up to a power of two
+        explicit SpscRing(size_t capacity)
+        : head(0)
+        , tail(0)
+        , cachedHead(0)
+        , cachedTail(0)
+        {
+            size_t c = 2;
+            while (c < capacity)
+                c <<= 1;
+            slots.resize(c);
+            mask = c - 1;
+        }
+
+        size_t capacity() const { return slots.size(); }
+
+        // producer side; returns false if the ring is full
+        bool push(const T& value)
+        {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - cachedHead == slots.size()) {
+                cachedHead = head.load(std::memory_order_acquire);
+                if (t - cachedHead == slots.size())
+                    return false;
+            }
+            slots[t & mask] = value;
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer side; returns the oldest element without removing it,
+        // or null if the ring is empty
+        T* front()
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == cachedTail) {
+                cachedTail = tail.load(std::memory_order_acquire);
+                if (h == cachedTail)
+                    return nullptr;
+            }
+            return &slots[h & mask];
+        }
+
+        // consumer side; returns the i'th oldest element without removing
+        // it, or null if the ring holds i elements or fewer
+        T* peek(size_t i)
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (cachedTail - h <= i) {
+                cachedTail = tail.load(std::memory_order_acquire);
+                if (cachedTail - h <= i)
+                    return nullptr;
+            }
+            return &slots[(h + i) & mask];
+        }
+
+        // consumer side; removes the element returned by front(), or the
+        // n oldest elements
+        void popFront(size_t n = 1)
+        {
+            head.store(head.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        }
+
+        // consumer side; returns false if the ring is empty
+        bool pop(T& value)
+        {
+            T* f = front();
+            if (!f)
+                return false;
+            value = *f;
+            popFront();
+            return true;
+        }
+
+        // may be called from either side, the result is approximate if the
+        // other side is active
+        size_t size() const
+        {
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+        }
+
+        bool empty() const { return size() == 0; }
+
+    private:
+        std::vector<T> slots;
+        size_t mask;
+
+        // head and tail are on separate cache lines so that the producer
+        // and consumer don't contend
+        alignas(64) std::atomic<size_t> head;   // written by the consumer
+        alignas(64) std::atomic<size_t> tail;   // written by the producer
+        alignas(64) size_t cachedHead;          // producer's view of head
+        alignas(64) size_t cachedTail;          // consumer's view of tail
+    };
+
+} // Lab
@@ -0,0 +1,249 @@
+//
+//  LabMidiRouter.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#include "LabMidi/Router.h"
+#include "LabMidiRcu.h"
+#include "LabMidiRing.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Lab {
+
+    namespace {
+
+        // The most events a worker hands its destination in one call
+        const size_t kDeliveryBatch = 256;
+
+        // A destination's queue, and the worker that drains it. The worker
+        // blocks when the queue is empty; as in MidiInQueue, it raises a
+        // flag before waiting, and the router only takes the lock to wake
+        // it when the flag is raised.
+        //
+        class Destination {
+        public:
+            Destination(MidiOutBase* out, size_t capacity)
+            : out(out)
+            , queue(capacity)
+            , pushed(false)
+            , dropped(0)
+            , quit(false)
+            , waiting(false)
+            , busy(false)
+            {
+                thread = std::thread(&Destination::run, this);
+            }
+
+            ~Destination()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    quit = true;
+                    signal.notify_one();
+                }
+                thread.join();
+            }
+
+            // router side
+            void push(const MidiRtEvent& ev)
+            {
+                if (queue.push(ev))
+                    pushed = true;
+                else
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // router side; wakes the worker if anything was pushed since
+            // the last call
+            void wake()
+            {
+                if (!pushed)
+                    return;
+                pushed = false;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (waiting.load(std::memory_order_relaxed)) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    signal.notify_one();
+                }
+            }
+
+            // waits until the worker has delivered everything queued
+            void flush()
+            {
+                while (!queue.empty() || busy.load())
+                    std::this_thread::yield();
+            }
+
+            MidiOutBase* out;
+            SpscRing<MidiRtEvent> queue;
+            bool pushed;                        // router only
+            std::atomic<uint64_t> dropped;
+
+        private:
+            void run()
+            {
+                MidiRtEvent batch[kDeliveryBatch];
+                while (!quit.load()) {
+                    busy.store(true);
+                    size_t n = 0;
+                    for (MidiRtEvent* ev; n < kDeliveryBatch && (ev = queue.peek(n)); ++n)
+                        batch[n] = *ev;
+                    if (n) {
+                        queue.popFront(n);
+                        out->events(batch, n);
+                        continue;
+                    }
+                    busy.store(false);
+
+                    std::unique_lock<std::mutex> lock(mutex);
+                    waiting.store(true, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    while (!quit.load() && queue.empty())
+                        signal.wait(lock);
+                    waiting.store(false, std::memory_order_relaxed);
+                }
+                busy.store(false);
+            }
+
+            std::thread thread;
+            std::atomic<bool> quit;
+            std::atomic<bool> waiting;
+            std::atomic<bool> busy;
+            std::mutex mutex;
+            std::condition_variable signal;
+        };
+
+        enum class RouteSource : uint8_t { Track, Channel };
+
+        struct Route {
+            RouteSource source;
+            int index;              // track or channel
+            int channel;            // -1 to keep the event's channel
+            Destination* destination;
+        };
+
+    } // anon
+
+    class MidiRouter::Detail
+    {
+    public:
+        explicit Detail(size_t capacity)
+        : capacity(capacity)
+        {
+        }
+
+        void route(const MidiRtEvent* ev, size_t count)
+        {
+            RcuList<Route>::Reader r(routes);
+            if (r.empty())
+                return;
+
+            for (size_t i = 0; i < count; ++i) {
+                uint8_t status = ev[i].command.command;
+                int channel = status < MIDI_SYSTEM_EXCLUSIVE ? status & 0xf : -1;
+                for (const Route& route : r) {
+                    int source = route.source == RouteSource::Track ? ev[i].track : channel;
+                    if (source != route.index)
+                        continue;
+                    if (route.channel < 0 || channel < 0)
+                        route.destination->push(ev[i]);
+                    else {
+                        MidiRtEvent e = ev[i];
+                        e.command.command = uint8_t((status & 0xf0) | route.channel);
+                        route.destination->push(e);
+                    }
+                }
+            }
+
+            for (const Route& route : r)
+                route.destination->wake();
+        }
+
+        Destination* destination(int i) const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return i >= 0 && size_t(i) < destinations.size() ? destinations[i].get() : nullptr;
+        }
+
+        size_t capacity;
+        RcuList<Route> routes;
+        mutable std::mutex mutex;   // guards destinations
+        std::vector<std::unique_ptr<Destination>> destinations;
+    };
+
+    MidiRouter::MidiRouter(size_t queueCapacity)
+    : _detail(new Detail(queueCapacity))
+    {
+    }
+
+    MidiRouter::~MidiRouter()
+    {
+        delete _detail;
+    }
+
+    int MidiRouter::addDestination(MidiOutBase* out)
+    {
+        if (!out)
+            return -1;
+        std::lock_guard<std::mutex> lock(_detail->mutex);
+        _detail->destinations.emplace_back(new Destination(out, _detail->capacity));
+        return int(_detail->destinations.size()) - 1;
+    }
+
+    int MidiRouter::destinationCount() const
+    {
+        std::lock_guard<std::mutex> lock(_detail->mutex);
+        return int(_detail->destinations.size());
+    }
+
+    bool MidiRouter::routeTrack(int track, int destination, int channel)
+    {
+        Destination* d = _detail->destination(destination);
+        if (!d || track < 0 || track > 255 || channel < -1 || channel > 15)
+            return false;
+        _detail->routes.add(Route{ RouteSource::Track, track, channel, d });
+        return true;
+    }
+
+    bool MidiRouter::routeChannel(int sourceChannel, int destination, int channel)
+    {
+        Destination* d = _detail->destination(destination);
+        if (!d || sourceChannel < 0 || sourceChannel > 15 || channel < -1 || channel > 15)
+            return false;
+        _detail->routes.add(Route{ RouteSource::Channel, sourceChannel, channel, d });
+        return true;
+    }
+
+    void MidiRouter::clearRoutes()
+    {
+        _detail->routes.removeIf([](const Route&) { return true; });
+    }
+
+    void MidiRouter::events(const MidiRtEvent* ev, size_t count)
+    {
+        _detail->route(ev, count);
+    }
+
+    void MidiRouter::flush()
+    {
+        int n = destinationCount();
+        for (int i = 0; i < n; ++i)
+            _detail->destination(i)->flush();
+    }
+
+    uint64_t MidiRouter::droppedCount(int destination) const
+    {
+        Destination* d = _detail->destination(destination);
+        return d ? d->dropped.load(std::memory_order_relaxed) : 0;
+    }
+
+} // Lab
@@ -0,0 +1,293 @@
+//
+//  LabMidiScheduler.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+#include "LabMidi/Scheduler.h"
+#include "LabMidi/MidiFilePlayer.h"
+#include "LabMidiRing.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace Lab {
+
+    namespace {
+
+        enum class SchedulerCommandType : uint8_t {
+            Add, Remove, Wake
+        };
+
+        struct SchedulerCommand {
+            SchedulerCommandType type = SchedulerCommandType::Wake;
+            MidiSongPlayer* player = nullptr;
+        };
+
+        const uint32_t kNotQueued = std::numeric_limits<uint32_t>::max();
+        const int64_t kNever = std::numeric_limits<int64_t>::max();
+
+    } // anon
+
+    class MidiScheduler::Detail
+    {
+    public:
+        // Each scheduled player has a node. The heap holds node indices
+        // ordered by due time, and each node records its position in the
+        // heap so that it can be repositioned or removed in O(log n).
+        //
+        struct Node {
+            MidiSongPlayer* player = nullptr;
+            int64_t time = 0;
+            uint32_t heapIndex = kNotQueued;
+        };
+
+        // Every player may be added and removed again before the next
+        // update, so the command queue holds two commands per player.
+        //
+        explicit Detail(size_t maxPlayers)
+        : commands(maxPlayers * 2)
+        , posted(0)
+        , applied(0)
+        , players(0)
+        {
+            nodes.reserve(maxPlayers);
+            heap.reserve(maxPlayers);
+            nodeIndex.reserve(maxPlayers);
+        }
+
+        bool post(SchedulerCommandType type, MidiSongPlayer* player)
+        {
+            if (!player)
+                return false;
+            SchedulerCommand c;
+            c.type = type;
+            c.player = player;
+            if (!commands.push(c))
+                return false;
+            ++posted;
+            return true;
+        }
+
+        bool settled() const
+        {
+            return applied.load(std::memory_order_acquire) == posted;
+        }
+
+        void applyCommands(int64_t wallclockTime)
+        {
+            SchedulerCommand c;
+            while (commands.pop(c)) {
+                auto i = nodeIndex.find(c.player);
+                switch (c.type) {
+                    case SchedulerCommandType::Add:
+                        if (i == nodeIndex.end()) {
+                            uint32_t n;
+                            if (freeNodes.empty()) {
+                                n = uint32_t(nodes.size());
+                                nodes.emplace_back();
+                            }
+                            else {
+                                n = freeNodes.back();
+                                freeNodes.pop_back();
+                            }
+                            nodes[n].player = c.player;
+                            nodeIndex[c.player] = n;
+                            reschedule(n, wallclockTime);
+                        }
+                        break;
+                    case SchedulerCommandType::Remove:
+                        if (i != nodeIndex.end()) {
+                            uint32_t n = i->second;
+                            unqueue(n);
+                            nodes[n] = Node();
+                            freeNodes.push_back(n);
+                            nodeIndex.erase(i);
+                        }
+                        break;
+                    case SchedulerCommandType::Wake:
+                        if (i != nodeIndex.end())
+                            reschedule(i->second, wallclockTime);
+                        break;
+                }
+                players.store(nodeIndex.size(), std::memory_order_relaxed);
+                applied.store(applied.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_release);
+            }
+        }
+
+        // Let the player drain its own commands, then requeue it according
+        // to its next event
+        void reschedule(uint32_t n, int64_t wallclockTime)
+        {
+            nodes[n].player->updateNs(wallclockTime);
+            requeue(n);
+        }
+
+        void requeue(uint32_t n)
+        {
+            Node& node = nodes[n];
+            node.time = node.player->nextEventTimeNs();
+            if (node.time == kNever) {
+                unqueue(n);
+                return;
+            }
+            if (node.heapIndex == kNotQueued) {
+                node.heapIndex = uint32_t(heap.size());
+                heap.push_back(n);
+            }
+            siftUp(node.heapIndex);
+            siftDown(node.heapIndex);
+        }
+
+        void update(int64_t wallclockTime)
+        {
+            applyCommands(wallclockTime);
+
+            while (!heap.empty() && nodes[heap[0]].time <= wallclockTime) {
+                uint32_t n = heap[0];
+                Node& node = nodes[n];
+
+                // Advance the player only to the due time so that events
+                // of other players in between are dispatched first.
+                node.player->updateNs(node.time);
+                requeue(n);
+            }
+        }
+
+        void unqueue(uint32_t n)
+        {
+            uint32_t h = nodes[n].heapIndex;
+            if (h == kNotQueued)
+                return;
+            nodes[n].heapIndex = kNotQueued;
+            uint32_t last = heap.back();
+            heap.pop_back();
+            if (last != n) {
+                heap[h] = last;
+                nodes[last].heapIndex = h;
+                siftUp(h);
+                siftDown(nodes[last].heapIndex);
+            }
+        }
+
+        void swap(uint32_t a, uint32_t b)
+        {
+            std::swap(heap[a], heap[b]);
+            nodes[heap[a]].heapIndex = a;
+            nodes[heap[b]].heapIndex = b;
+        }
+
+        void siftUp(uint32_t h)
+        {
+            while (h > 0) {
+                uint32_t parent = (h - 1) / 2;
+                if (nodes[heap[parent]].time <= nodes[heap[h]].time)
+                    break;
+                swap(h, parent);
+                h = parent;
+            }
+        }
+
+        void siftDown(uint32_t h)
+        {
+            uint32_t size = uint32_t(heap.size());
+            while (true) {
+                uint32_t smallest = h;
+                uint32_t l = h * 2 + 1;
+                uint32_t r = l + 1;
+                if (l < size && nodes[heap[l]].time < nodes[heap[smallest]].time)
+                    smallest = l;
+                if (r < size && nodes[heap[r]].time < nodes[heap[smallest]].time)
+                    smallest = r;
+                if (smallest == h)
+                    break;
+                swap(h, smallest);
+                h = smallest;
+            }
+        }
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> freeNodes;
+        std::vector<uint32_t> heap;
+        std::unordered_map<MidiSongPlayer*, uint32_t> nodeIndex;
+
+        SpscRing<SchedulerCommand> commands;
+
+        // Commands pushed by the control thread, and commands applied by
+        // the thread driving update()
+        uint64_t posted;
+        std::atomic<uint64_t> applied;
+
+        // the size of nodeIndex, for threads other than the one driving
+        // update()
+        std::atomic<size_t> players;
+    };
+
+    MidiScheduler::MidiScheduler(size_t maxPlayers)
+    : _detail(new Detail(maxPlayers))
+    {
+    }
+
+    MidiScheduler::~MidiScheduler()
+    {
+        delete _detail;
+    }
+
+    bool MidiScheduler::add(MidiSongPlayer* player)
+    {
+        return _detail->post(SchedulerCommandType::Add, player);
+    }
+
+    bool MidiScheduler::remove(MidiSongPlayer* player)
+    {
+        return _detail->post(SchedulerCommandType::Remove, player);
+    }
+
+    bool MidiScheduler::wake(MidiSongPlayer* player)
+    {
+        return _detail->post(SchedulerCommandType::Wake, player);
+    }
+
+    bool MidiScheduler::settled() const
+    {
+        return _detail->settled();
+    }
+
+    void MidiScheduler::updateNs(int64_t wallclockTime)
+    {
+        _detail->update(wallclockTime);
+    }
+
+    void MidiScheduler::update(float wallclockTime)
+    {
+        _detail->update(int64_t(std::llround(double(wallclockTime) * 1.0e9)));
+    }
+
+    int64_t MidiScheduler::nextEventTimeNs() const
+    {
+        if (_detail->heap.empty())
+            return kNever;
+        return _detail->nodes[_detail->heap[0]].time;
+    }
+
+    float MidiScheduler::nextEventTime() const
+    {
+        int64_t t = nextEventTimeNs();
+        if (t == kNever)
+            return std::numeric_limits<float>::max();
+        return float(double(t) * 1.0e-9);
+    }
+
+    size_t MidiScheduler::playerCount() const
+    {
+        return _detail->players.load(std::memory_order_relaxed);
+    }
+
+} // Lab
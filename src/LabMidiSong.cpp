@@ -90,6 +90,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "LabMidi/MidiFile.h"
 
 #include "LabMidi/MidiInOut.h"
+#include "LabMidiMeta.h"
 
 #include <stdexcept>
 #include <iostream>
@@ -345,8 +346,10 @@ MidiEvent* parseEvent(uint8_t const*& dataStart, uint8_t lastEventTypeByte)
             switch(subtype) {
 
             case Midi_MetaEventType::WHAT_is_THIS: {
-                dataStart += length;
                 auto event = new Event_Unknown();
+                event->metaType = uint8_t(subtype);
+                event->data.assign(dataStart, dataStart + length);
+                dataStart += length;
                 return event;
             }
 
@@ -443,9 +446,9 @@ MidiEvent* parseEvent(uint8_t const*& dataStart, uint8_t lastEventTypeByte)
             case Midi_MetaEventType::TIME_SIGNATURE: {
                 if (length != 4) throw std::invalid_argument("Expected length for TIME_SIGNATURE event is 4");
                 auto event = new Event_TimeSignature();
-                double num = double(*dataStart++);
-                double denom = double(*dataStart++);
-                event->timeSignature = num / std::pow(2., denom);
+                event->numerator = *dataStart++;
+                event->denominator = *dataStart++;
+                event->timeSignature = double(event->numerator) / std::pow(2., double(event->denominator));
                 event->metronome = *dataStart++;
                 event->thirtyseconds = *dataStart++;
                 return event;
@@ -467,6 +470,7 @@ MidiEvent* parseEvent(uint8_t const*& dataStart, uint8_t lastEventTypeByte)
             }
             // console.log("Unrecognised meta event subtype: " + subtypeByte);
             auto event = new Event_Unknown();
+            event->metaType = uint8_t(subtype);
             event->data.resize(length);
             memcpy(event->data.data(), dataStart, length);
             dataStart += length;
@@ -686,13 +690,84 @@ void MidiSong::parse(char const*const path, bool verbose)
 }
 
 
+namespace {
+
+    void writeMetaEvent(Midi_MetaEventType type, const uint8_t* data, size_t length, std::vector<uint8_t>& out)
+    {
+        out.push_back(0xff);
+        out.push_back(uint8_t(type));
+        mm::write_variable_length(uint32_t(length), out);
+        out.insert(out.end(), data, data + length);
+    }
+
+    // Appends an event's bytes, not including its delta time, returning
+    // false for events that have no file representation
+    bool writeEvent(const MidiEvent* event, std::vector<uint8_t>& out)
+    {
+        const std::vector<uint8_t>& data = event->data;
+        switch (event->eventType) {
+            case Midi_MetaEventType::LABMIDI_CHANNEL_EVENT: {
+                if (data.size() < 2)
+                    return false;
+                out.push_back(data[0]);
+                out.push_back(data[1]);
+                // program change and channel pressure have one data byte
+                uint8_t status = data[0] & 0xf0;
+                if (status != 0xc0 && status != 0xd0)
+                    out.push_back(data.size() > 2 ? data[2] : 0);
+                return true;
+            }
+            case Midi_MetaEventType::SYSTEM_EXCLUSIVE:
+            case Midi_MetaEventType::END_OF_EXCLUSIVE:
+                // data follows the 0xf0 or 0xf7, and includes any final 0xf7
+                out.push_back(uint8_t(event->eventType));
+                mm::write_variable_length(uint32_t(data.size()), out);
+                out.insert(out.end(), data.begin(), data.end());
+                return true;
+            case Midi_MetaEventType::SEQUENCE_NUMBER:
+            case Midi_MetaEventType::MIDI_CHANNEL_PREFIX:
+            case Midi_MetaEventType::TEMPO_CHANGE:
+            case Midi_MetaEventType::SMPTE_OFFSET:
+            case Midi_MetaEventType::TIME_SIGNATURE:
+            case Midi_MetaEventType::KEY_SIGNATURE: {
+                uint8_t b[kMaxMetaFieldBytes];
+                size_t n = metaEventFields(event, b);
+                writeMetaEvent(event->eventType, b, n, out);
+                return true;
+            }
+            case Midi_MetaEventType::TEXT:
+            case Midi_MetaEventType::COPYRIGHT:
+            case Midi_MetaEventType::TRACK_NAME:
+            case Midi_MetaEventType::INSTRUMENT:
+            case Midi_MetaEventType::LYRIC:
+            case Midi_MetaEventType::MARKER:
+            case Midi_MetaEventType::CUE:
+            case Midi_MetaEventType::PATCH_NAME:
+            case Midi_MetaEventType::DEVICE_NAME:
+            case Midi_MetaEventType::PROPRIETARY:
+                writeMetaEvent(event->eventType, data.data(), data.size(), out);
+                return true;
+            case Midi_MetaEventType::UNKNOWN: {
+                uint8_t type = static_cast<const Event_Unknown*>(event)->metaType;
+                if (type == 0xff)
+                    return false;
+                writeMetaEvent(Midi_MetaEventType(type), data.data(), data.size(), out);
+                return true;
+            }
+            default:
+                return false;
+        }
+    }
+
+} // anon
+
 void MidiSong::writeMidi(std::ostream& out)
 {
     // MIDI File Header
     out << 'M'; out << 'T'; out << 'h'; out << 'd';
 
     uint16_t num_tracks = static_cast<uint16_t>(tracks.size());
-    uint16_t ticks_per_quarter_note = 120; /// @TODO default value, should store something in the loader, how does it relate to ticksPerBeat?
+    uint16_t ticks_per_quarter_note = static_cast<uint16_t>(ticksPerBeat);
 
     mm::write_uint32_be(out, 6);
     mm::write_uint16_be(out, num_tracks == 1 ? 0 : 1);
@@ -703,62 +778,38 @@ void MidiSong::writeMidi(std::ostream& out)
 
     for (auto midi_track : tracks)
     {
+        trackRawData.clear();
+
+        // the delta time of an event that isn't written carries over to
+        // the next event
+        uint32_t delta = 0;
         for (MidiEvent* event : midi_track->events)
         {
-            const Midi_MetaEventType msg = event->eventType;
+            delta += event->tick;
 
             // Suppress end-of-track meta messages (one will be added
-            // automatically after all track data has been written).
-            if (msg == Midi_MetaEventType::END_OF_TRACK)
+            // after all track data has been written).
+            if (event->eventType == Midi_MetaEventType::END_OF_TRACK)
                 continue;
 
-            mm::write_variable_length(event->tick, trackRawData);
-#if 0
-            if ((msg == Midi_MetaEventType::SYSTEM_EXCLUSIVE) || (msg == Midi_MetaEventType::END_OF_SYSTEM_EXCLUSIVE))
-            {
-                // 0xf0 == Complete sysex message (0xf0 is part of the raw MIDI).
-                // 0xf7 == Raw byte message (0xf7 not part of the raw MIDI).
-                // Print the first byte of the message (0xf0 or 0xf7), then
-                // print a VLV length for the rest of the bytes in the message.
-                // In other words, when creating a 0xf0 or 0xf7 MIDI message,
-                // do not insert the VLV byte length yourself, as this code will
-                // do it for you automatically.
-                trackRawData.emplace_back(msg->data[0]); // 0xf0 or 0xf7;
-
-                mm::write_variable_length(uint32_t(msg->messageSize() - 1), trackRawData);
-
-                for (size_t k = 1; k < msg->messageSize(); k++)
-                {
-                    trackRawData.emplace_back((*msg)[k]);
-                }
-            }
+            size_t mark = trackRawData.size();
+            mm::write_variable_length(delta, trackRawData);
+            if (writeEvent(event, trackRawData))
+                delta = 0;
             else
-            {
-                // Non-sysex type of message, so just output the bytes of the message:
-                for (size_t k = 0; k < msg->messageSize(); k++)
-                {
-                    trackRawData.emplace_back((*msg)[k]);
-                }
-            }
-#endif
+                trackRawData.resize(mark);
         }
-    }
-
-    auto size = trackRawData.size();
 
-    // if the track is too small to have an end, or the final data is not an end of track, then write an end of track.
-    if ((size < 3) || !((trackRawData[size - 3] == 0xFF) && (trackRawData[size - 2] == 0x2F)))
-    {
-        trackRawData.emplace_back(0x0); // tick
+        mm::write_variable_length(delta, trackRawData);
         trackRawData.emplace_back(0xFF);
         trackRawData.emplace_back(0x2F);
         trackRawData.emplace_back(0x00);
-    }
 
-    // Write the track ID marker "MTrk":
-    out << 'M'; out << 'T'; out << 'r'; out << 'k';
-    mm::write_uint32_be(out, uint32_t(trackRawData.size()));
-    out.write((char*)trackRawData.data(), trackRawData.size());
+        // Write the track ID marker "MTrk":
+        out << 'M'; out << 'T'; out << 'r'; out << 'k';
+        mm::write_uint32_be(out, uint32_t(trackRawData.size()));
+        out.write((char*)trackRawData.data(), trackRawData.size());
+    }
 }
 
 //------------------------------------------------------------
@@ -33,79 +33,595 @@
 #include "LabMidi/MidiFilePlayer.h"
 #include "LabMidi/MidiInOut.h"
 #include "LabMidi/Util.h"
+#include "LabMidiHistogram.h"
+#include "LabMidiMeta.h"
+#include "LabMidiRcu.h"
+#include "LabMidiRing.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
 #include <limits>
+#include <memory>
+#include <string_view>
 #include <vector>
 #include <cstdint>
 
 namespace Lab {
     
+    namespace {
+
+        enum class PlayerCommandType : uint8_t {
+            Play, Stop, Pause, Resume, Seek, Speed, Mute, MetaCallback
+        };
+
+        struct PlayerCommand {
+            PlayerCommandType type = PlayerCommandType::Stop;
+            int64_t time = 0;
+            double value = 0;
+            MidiMetaCallbackFn metaFn = nullptr;
+            void* userData = nullptr;
+        };
+
+        const int64_t kNever = std::numeric_limits<int64_t>::max();
+
+        int64_t secondsToNanoseconds(float seconds)
+        {
+            return int64_t(std::llround(double(seconds) * 1.0e9));
+        }
+
+        float nanosecondsToSeconds(int64_t ns)
+        {
+            if (ns == kNever)
+                return std::numeric_limits<float>::max();
+            return float(double(ns) * 1.0e-9);
+        }
+
+        // index of the lowest set bit; v must not be zero
+        int lowestBit(uint64_t v)
+        {
+#if defined(_MSC_VER)
+            unsigned long i;
+            _BitScanForward64(&i, v);
+            return int(i);
+#else
+            return __builtin_ctzll(v);
+#endif
+        }
+
+        // Notes sounding on each channel, as a 128 bit set per channel,
+        // with the velocity and track that struck them
+        struct ActiveNotes {
+            uint64_t bits[16][2];
+            uint8_t velocity[16][128];
+            uint8_t track[16][128];
+
+            ActiveNotes() { clear(); }
+
+            void clear()
+            {
+                for (int c = 0; c < 16; ++c)
+                    bits[c][0] = bits[c][1] = 0;
+            }
+
+            bool empty() const
+            {
+                uint64_t any = 0;
+                for (int c = 0; c < 16; ++c)
+                    any |= bits[c][0] | bits[c][1];
+                return any == 0;
+            }
+
+            bool sounding(const MidiCommand& m) const
+            {
+                int note = m.byte1 & 0x7f;
+                return (bits[m.command & 0x0f][note >> 6] >> (note & 63)) & 1;
+            }
+            
+            void record(const MidiRtEvent& ev)
+            {
+                const MidiCommand& m = ev.command;
+                uint8_t status = m.command & 0xf0;
+                int c = m.command & 0x0f;
+                int note = m.byte1 & 0x7f;
+                uint64_t bit = uint64_t(1) << (note & 63);
+                if (status == MIDI_NOTE_ON && m.byte2 > 0) {
+                    bits[c][note >> 6] |= bit;
+                    velocity[c][note] = m.byte2;
+                    track[c][note] = ev.track;
+                }
+                else if (status == MIDI_NOTE_OFF || status == MIDI_NOTE_ON)
+                    bits[c][note >> 6] &= ~bit;
+            }
+
+            // Appends a note off, or a note on at the original velocity if
+            // strike is true, for every sounding note
+            void emit(std::vector<MidiRtEvent>& out, int64_t time, bool strike) const
+            {
+                for (int c = 0; c < 16; ++c)
+                    for (int w = 0; w < 2; ++w)
+                        for (uint64_t b = bits[c][w]; b; b &= b - 1) {
+                            int note = w * 64 + lowestBit(b);
+                            if (strike)
+                                out.push_back(MidiRtEvent(time, uint8_t(MIDI_NOTE_ON | c), uint8_t(note), velocity[c][note], track[c][note]));
+                            else
+                                out.push_back(MidiRtEvent(time, uint8_t(MIDI_NOTE_OFF | c), uint8_t(note), 0, track[c][note]));
+                        }
+            }
+        };
+
+        template <typename T>
+        void setMaskBit(std::atomic<T>& mask, int bit, bool set)
+        {
+            T b = T(T(1) << bit);
+            if (set)
+                mask.fetch_or(b, std::memory_order_relaxed);
+            else
+                mask.fetch_and(T(~b), std::memory_order_relaxed);
+        }
+
+        struct DispatchHistograms {
+            Histogram lateness;
+            Histogram eventsPerUpdate;
+            Histogram sinkTime;
+        };
+
+    } // anon
+
     class MidiSongPlayer::Detail
     {
     public:
         
         Detail(MidiSong* s)
         : song(s)
-        , startTime(0)
+        , anchorWallTime(0)
+        , anchorSongTime(0)
+        , speed(1)
+        , playing(true)
+        , paused(false)
+        , muted(false)
         , eventCursor(0)
+        , metaCursor(0)
+        , metaFn(nullptr)
+        , metaUserData(nullptr)
+        , commands(256)
+        , trackMute(0)
+        , trackSolo(0)
+        , channelMute(0)
+        , channelSolo(0)
+        , instrumented(false)
+        , histograms(nullptr)
         {
-            beatsPerMinute = s ? s->startingTempo : 120.0f; // 120 is the standard default value
+            float beatsPerMinute = s ? s->startingTempo : 120.0f; // 120 is the standard default value
+            microsecondsPerBeat = 60000000.0 / beatsPerMinute;
             ticksPerBeat = s ? s->ticksPerBeat : 100.0f;    // 100 is an arbitrary safe value
             events.reserve(10000);  // arbritrarily large to avoid push_back delays
+            noteEvents.reserve(16 * 128);
+        }
+        
+        ~Detail()
+        {
+            delete histograms.load();
+        }
+        
+        bool post(PlayerCommandType type, int64_t time = 0, double value = 0)
+        {
+            PlayerCommand c;
+            c.type = type;
+            c.time = time;
+            c.value = value;
+            return commands.push(c);
         }
         
-        void update(float wallclockTime)
+        int64_t songTime(int64_t wallclockTime) const
         {
+            int64_t elapsed = wallclockTime - anchorWallTime;
+            if (speed == 1)
+                return anchorSongTime + elapsed;
+            return anchorSongTime + int64_t(double(elapsed) * speed);
+        }
+        
+        // Re-anchor the timeline so that changes of speed or position take
+        // effect from wallclockTime onwards
+        void anchor(int64_t wallclockTime, int64_t song)
+        {
+            anchorWallTime = wallclockTime;
+            anchorSongTime = song;
+        }
+        
+        void applyCommands(int64_t wallclockTime)
+        {
+            PlayerCommand c;
+            while (commands.pop(c)) {
+                switch (c.type) {
+                    case PlayerCommandType::Play:
+                        releaseNotes(songTime(wallclockTime));
+                        anchor(c.time, 0);
+                        eventCursor = 0;
+                        metaCursor = 0;
+                        playing = true;
+                        paused = false;
+                        break;
+                    case PlayerCommandType::Stop:
+                        releaseNotes(songTime(wallclockTime));
+                        anchor(wallclockTime, 0);
+                        eventCursor = 0;
+                        metaCursor = 0;
+                        playing = false;
+                        paused = false;
+                        break;
+                    case PlayerCommandType::Pause:
+                        if (playing) {
+                            int64_t t = songTime(wallclockTime);
+                            held = active;
+                            releaseNotes(t);
+                            anchor(wallclockTime, t);
+                            playing = false;
+                            paused = true;
+                        }
+                        break;
+                    case PlayerCommandType::Resume:
+                        resume(wallclockTime);
+                        break;
+                    case PlayerCommandType::Seek: {
+                        int64_t t = std::max(int64_t(0), c.time);
+                        releaseNotes(songTime(wallclockTime));
+                        held.clear();
+                        anchor(wallclockTime, t);
+                        auto i = std::lower_bound(events.begin(), events.end(), t,
+                                                  [](const MidiRtEvent& ev, int64_t t) { return ev.timeNs < t; });
+                        eventCursor = size_t(i - events.begin());
+                        auto m = std::lower_bound(meta.begin(), meta.end(), t,
+                                                  [](const MidiMetaEvent& ev, int64_t t) { return ev.timeNs < t; });
+                        metaCursor = size_t(m - meta.begin());
+                        break;
+                    }
+                    case PlayerCommandType::Speed:
+                        if (!paused)
+                            anchor(wallclockTime, songTime(wallclockTime));
+                        speed = std::max(0., c.value);
+                        break;
+                    case PlayerCommandType::Mute:
+                        muted = c.value != 0;
+                        if (muted) {
+                            releaseNotes(songTime(wallclockTime));
+                            held.clear();
+                        }
+                        break;
+                    case PlayerCommandType::MetaCallback:
+                        metaFn = c.metaFn;
+                        metaUserData = c.userData;
+                        break;
+                }
+            }
+        }
+        
+        void resume(int64_t wallclockTime)
+        {
+            if (!paused)
+                return;
+            anchor(wallclockTime, anchorSongTime);
+            playing = true;
+            paused = false;
+            if (!muted) {
+                active = held;
+                dispatchNotes(anchorSongTime, true);
+            }
+            held.clear();
+        }
+        
+        // Sends a note off for every sounding note
+        void releaseNotes(int64_t songTime)
+        {
+            dispatchNotes(songTime, false);
+            active.clear();
+        }
+        
+        void dispatchNotes(int64_t songTime, bool strike)
+        {
+            if (active.empty())
+                return;
+            noteEvents.clear();
+            active.emit(noteEvents, songTime, strike);
+            dispatch(noteEvents.data(), noteEvents.size());
+        }
+        
+        void dispatch(const MidiRtEvent* ev, size_t count)
+        {
+            RcuList<SinkEntry>::Reader s(sinks);
+            for (auto i = s.begin(); i != s.end(); ++i)
+                i->sink->events(ev, count);
+        }
+        
+        void update(int64_t wallclockTime)
+        {
+            applyCommands(wallclockTime);
+            
+            if (!playing)
+                return;
+            
+            while (metaCursor < meta.size() && wallTime(meta[metaCursor].timeNs) <= wallclockTime) {
+                if (metaFn)
+                    metaFn(metaUserData, &meta[metaCursor]);
+                ++metaCursor;
+            }
+            
             if (eventCursor >= events.size())
                 return;
             
-            float newTime = wallclockTime - startTime;
-            while (eventCursor < events.size() && events[eventCursor].time <= newTime) {
-
-                MidiRtEvent& ev = events[eventCursor];
-
-                for (auto i = callbacks.begin(); i != callbacks.end(); ++i)
-                    (*i).second((*i).first, &ev);
-                
+            // the events due are contiguous, so each sink gets them in one call
+            size_t first = eventCursor;
+            while (eventCursor < events.size() && eventWallTime(eventCursor) <= wallclockTime)
                 ++eventCursor;
+            
+            if (muted || eventCursor == first)
+                return;
+            
+            DispatchHistograms* h = nullptr;
+            int64_t sinkStart = 0;
+            if (instrumented.load(std::memory_order_relaxed)) {
+                h = histograms.load(std::memory_order_acquire);
+                for (size_t i = first; i < eventCursor; ++i)
+                    h->lateness.record(wallclockTime - eventWallTime(i));
+                h->eventsPerUpdate.record(int64_t(eventCursor - first));
+                sinkStart = monotonicNanoseconds();
+            }
+            
+            const MidiRtEvent* batch = &events[first];
+            size_t count = eventCursor - first;
+            if (masked()) {
+                count = filter(batch, count);
+                batch = filtered.data();
+            }
+            
+            if (count)
+                dispatch(batch, count);
+            
+            if (h)
+                h->sinkTime.record(monotonicNanoseconds() - sinkStart);
+            
+            for (size_t i = 0; i < count; ++i)
+                active.record(batch[i]);
+        }
+        
+        bool masked() const
+        {
+            return (trackMute.load(std::memory_order_relaxed) | trackSolo.load(std::memory_order_relaxed) |
+                    channelMute.load(std::memory_order_relaxed) | channelSolo.load(std::memory_order_relaxed)) != 0;
+        }
+        
+        // Copies the audible events to the filtered buffer
+        size_t filter(const MidiRtEvent* ev, size_t count)
+        {
+            uint64_t tm = trackMute.load(std::memory_order_relaxed);
+            uint64_t ts = trackSolo.load(std::memory_order_relaxed);
+            uint16_t cm = channelMute.load(std::memory_order_relaxed);
+            uint16_t cs = channelSolo.load(std::memory_order_relaxed);
+            bool soloing = (ts | cs) != 0;
+            
+            filtered.clear();
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t tb = uint64_t(1) << std::min(int(ev[i].track), 63);
+                uint16_t cb = uint16_t(1 << (ev[i].command.command & 0x0f));
+                bool audible = !(tm & tb) && !(cm & cb) && (!soloing || (ts & tb) || (cs & cb));
+                if (!audible) {
+                    // let a sounding note end, so it doesn't hang
+                    uint8_t status = ev[i].command.command & 0xf0;
+                    bool noteOff = status == MIDI_NOTE_OFF || (status == MIDI_NOTE_ON && ev[i].command.byte2 == 0);
+                    audible = noteOff && active.sounding(ev[i].command);
+                }
+                if (audible)
+                    filtered.push_back(ev[i]);
             }
+            return filtered.size();
         }
         
-        double ticksToSeconds(int ticks)
+        void freewheel(int64_t songTimeLimit)
         {
-            double beats = double(ticks) / ticksPerBeat;
-            double seconds = beats / (beatsPerMinute / 60.f);
-            return seconds;
+            applyCommands(anchorWallTime);
+            if (paused)
+                resume(anchorWallTime);
+            else if (!playing) {
+                anchor(0, 0);
+                eventCursor = 0;
+                playing = true;
+            }
+            
+            // update drains commands as it goes, so a control thread can
+            // still stop, seek, or mute a render in progress
+            while (playing) {
+                int64_t next = nextSongTime();
+                if (next == kNever || next > songTimeLimit)
+                    break;
+                int64_t t = wallTime(next);
+                if (t == kNever)
+                    break;
+                update(t);
+            }
         }
         
-        double secondsToTicks(float seconds)
+        // Dispatch compares wall clock times computed here, rather than
+        // song times, so that passing nextEventTime() to update() is
+        // guaranteed to dispatch the event. At normal speed the mapping is
+        // exact integer arithmetic.
+        int64_t wallTime(int64_t songTime) const
         {
-            double ticksPerSecond = (beatsPerMinute * ticksPerBeat) / 60.f;
-            double ticks = ticksPerSecond * seconds;
-            return (int)ticks;
+            int64_t t = songTime - anchorSongTime;
+            if (speed == 1)
+                return anchorWallTime + t;
+            if (speed <= 0)
+                return kNever;
+            return anchorWallTime + int64_t(double(t) / speed);
         }
         
-        void recordEvent(double now, MidiEvent* ev)
+        int64_t eventWallTime(size_t i) const
+        {
+            return wallTime(events[i].timeNs);
+        }
+        
+        // the song time of the next channel or meta event
+        int64_t nextSongTime() const
+        {
+            int64_t t = kNever;
+            if (eventCursor < events.size())
+                t = events[eventCursor].timeNs;
+            if (metaCursor < meta.size())
+                t = std::min(t, meta[metaCursor].timeNs);
+            return t;
+        }
+        
+        int64_t nextEventTime() const
+        {
+            int64_t t = nextSongTime();
+            if (!playing || t == kNever)
+                return kNever;
+            return wallTime(t);
+        }
+        
+        int64_t ticksToNanoseconds(int ticks) const
+        {
+            return int64_t(std::llround(double(ticks) * microsecondsPerBeat * 1000.0 / ticksPerBeat));
+        }
+        
+        void recordEvent(int64_t now, int track, MidiEvent* ev)
         {
             if (ev->eventType == Midi_MetaEventType::TEMPO_CHANGE) {
                 Event_SetTempo* ste = (Event_SetTempo*) ev;
-                beatsPerMinute = 60000000.0f / float(ste->microsecondsPerBeat);
+                microsecondsPerBeat = double(ste->microsecondsPerBeat);
             }
-            else if (ev->eventType == Midi_MetaEventType::LABMIDI_CHANNEL_EVENT && ev->data.size() >= 2) {
-                events.push_back(MidiRtEvent(float(now), ev->data[0], ev->data[1], ev->data[2]));
+            
+            if (ev->eventType == Midi_MetaEventType::LABMIDI_CHANNEL_EVENT) {
+                if (ev->data.size() >= 2)
+                    events.push_back(MidiRtEvent(now, ev->data[0], ev->data[1], ev->data[2], uint8_t(std::min(track, 255))));
+            }
+            else if (uint8_t(ev->eventType) < 0x80 && ev->eventType != Midi_MetaEventType::END_OF_TRACK) {
+                // data is temporarily an offset into metaData, see indexMeta.
+                // Events parsed into fields carry them in their file form.
+                uint8_t fields[kMaxMetaFieldBytes];
+                size_t n = metaEventFields(ev, fields);
+                MidiMetaEvent m;
+                m.timeNs = now;
+                m.type = ev->eventType;
+                m.track = track;
+                m.data = nullptr;
+                m.size = n ? n : ev->data.size();
+                meta.push_back(m);
+                metaOffsets.push_back(metaData.size());
+                if (n)
+                    metaData.insert(metaData.end(), fields, fields + n);
+                else
+                    metaData.insert(metaData.end(), ev->data.begin(), ev->data.end());
             }
         }
         
+        // Once all events are recorded, point the meta events at their data,
+        // and build the indices
+        void indexMeta()
+        {
+            for (size_t i = 0; i < meta.size(); ++i)
+                meta[i].data = metaData.data() + metaOffsets[i];
+            metaOffsets.clear();
+            metaOffsets.shrink_to_fit();
+            
+            metaByType.resize(meta.size());
+            for (uint32_t i = 0; i < meta.size(); ++i)
+                metaByType[i] = i;
+            
+            // meta is in time order, so a stable sort by type leaves each
+            // type's events in time order
+            std::stable_sort(metaByType.begin(), metaByType.end(), [this](uint32_t a, uint32_t b) {
+                return meta[a].type < meta[b].type;
+            });
+            
+            metaByName = metaByType;
+            std::stable_sort(metaByName.begin(), metaByName.end(), [this](uint32_t a, uint32_t b) {
+                if (meta[a].type != meta[b].type)
+                    return meta[a].type < meta[b].type;
+                return metaName(a) < metaName(b);
+            });
+        }
+        
+        std::string_view metaName(uint32_t i) const
+        {
+            return std::string_view((const char*) meta[i].data, meta[i].size);
+        }
+        
+        const MidiMetaEvent* nextMeta(Midi_MetaEventType type, int64_t songTime) const
+        {
+            auto i = std::upper_bound(metaByType.begin(), metaByType.end(), std::make_pair(type, songTime),
+                                      [this](const std::pair<Midi_MetaEventType, int64_t>& key, uint32_t m) {
+                                          return key.first < meta[m].type ||
+                                                 (key.first == meta[m].type && key.second < meta[m].timeNs);
+                                      });
+            if (i == metaByType.end() || meta[*i].type != type)
+                return nullptr;
+            return &meta[*i];
+        }
+        
+        const MidiMetaEvent* findMeta(Midi_MetaEventType type, std::string_view name) const
+        {
+            auto i = std::lower_bound(metaByName.begin(), metaByName.end(), std::make_pair(type, name),
+                                      [this](uint32_t m, const std::pair<Midi_MetaEventType, std::string_view>& key) {
+                                          return meta[m].type < key.first ||
+                                                 (meta[m].type == key.first && metaName(m) < key.second);
+                                      });
+            if (i == metaByName.end() || meta[*i].type != type || metaName(*i) != name)
+                return nullptr;
+            return &meta[*i];
+        }
+        
         std::vector<MidiRtEvent> events;
         
         MidiSong* song;
         
-        float startTime;
-        float beatsPerMinute;
+        // all times are in nanoseconds
+        int64_t anchorWallTime;
+        int64_t anchorSongTime;
+        double speed;
+        bool playing;
+        bool paused;
+        bool muted;
+        double microsecondsPerBeat;
         double ticksPerBeat;
-        int eventCursor;
+        size_t eventCursor;
+        
+        // meta events are kept apart from the channel events, in time order,
+        // with indices sorted by type and time, and by type and name
+        std::vector<MidiMetaEvent> meta;
+        std::vector<uint8_t> metaData;
+        std::vector<size_t> metaOffsets;
+        std::vector<uint32_t> metaByType;
+        std::vector<uint32_t> metaByName;
+        size_t metaCursor;
+        MidiMetaCallbackFn metaFn;
+        void* metaUserData;
         
-        std::vector<std::pair<void*, MidiEventCallbackFn> > callbacks;
+        // only touched by the thread calling update
+        ActiveNotes active;
+        ActiveNotes held;                       // notes to strike on resume
+        std::vector<MidiRtEvent> noteEvents;    // scratch for note offs and strikes
+        std::vector<MidiRtEvent> filtered;      // scratch for masked dispatch
+        
+        // Callbacks are wrapped in adapters owned by the entry, which live
+        // until the last snapshot referring to them is reclaimed
+        struct SinkEntry {
+            MidiEventSink* sink;
+            std::shared_ptr<MidiCallbackSink> adapter;
+        };
+        RcuList<SinkEntry> sinks;
+        
+        SpscRing<PlayerCommand> commands;
+        
+        // written by any thread, read by the thread calling update
+        std::atomic<uint64_t> trackMute;
+        std::atomic<uint64_t> trackSolo;
+        std::atomic<uint16_t> channelMute;
+        std::atomic<uint16_t> channelSolo;
+        
+        // allocated the first time instrumentation is enabled
+        std::atomic<bool> instrumented;
+        std::atomic<DispatchHistograms*> histograms;
     };
     
     MidiSongPlayer::MidiSongPlayer(MidiSong* s)
@@ -114,8 +630,8 @@ namespace Lab {
         if (s) {
             size_t tc = s->tracks.size();
             
-            // double, because don't want to introduce sync slip during rendering
-            std::vector<double> nextTime;
+            // integer nanoseconds, so that there's no sync slip during rendering
+            std::vector<int64_t> nextTime;
             nextTime.resize(tc);
             std::vector<int> nextIndex;
             nextIndex.resize(tc);
@@ -123,12 +639,12 @@ namespace Lab {
             int i = 0;
             for (auto t = s->tracks.begin(); t != s->tracks.end(); ++t, ++i) {
                 size_t ec = (*t)->events.size();
-                nextTime[i] = ec ? (*t)->events[0]->tick : std::numeric_limits<double>::max();
+                nextTime[i] = ec ? _detail->ticksToNanoseconds((*t)->events[0]->tick) : kNever;
                 nextIndex[i] = ec ? 0 : -1;
             }
             
             do {
-                double nextEventT = std::numeric_limits<double>::max();
+                int64_t nextEventT = kNever;
                 int nt = -1;
                 for (int i = 0; i < tc; ++i) {
                     if (nextIndex[i] >= s->tracks[i]->events.size())
@@ -142,13 +658,18 @@ namespace Lab {
                     break;
                 
                 MidiEvent* ev = s->tracks[nt]->events[nextIndex[nt]];
-                _detail->recordEvent(nextTime[nt], ev);
+                _detail->recordEvent(nextTime[nt], nt, ev);
                 ++nextIndex[nt];
                 int n = nextIndex[nt];
                 if (n < s->tracks[nt]->events.size())
-                    nextTime[nt] += _detail->ticksToSeconds(s->tracks[nt]->events[n]->tick);
+                    nextTime[nt] += _detail->ticksToNanoseconds(s->tracks[nt]->events[n]->tick);
             } while (true);
+            
+            _detail->indexMeta();
         }
+
+        // no batch exceeds the song, so masked dispatch never allocates
+        _detail->filtered.reserve(_detail->events.size());
     }
     
     MidiSongPlayer::~MidiSongPlayer()
@@ -156,37 +677,262 @@ namespace Lab {
         delete _detail;
     }
     
-    void MidiSongPlayer::play(float wallclockTime)
+    bool MidiSongPlayer::playNs(int64_t wallclockTime)
     {
-        _detail->startTime = wallclockTime;
+        return _detail->post(PlayerCommandType::Play, wallclockTime);
     }
     
-    void MidiSongPlayer::update(float wallclockTime)
+    bool MidiSongPlayer::play(float wallclockTime)
+    {
+        return playNs(secondsToNanoseconds(wallclockTime));
+    }
+    
+    bool MidiSongPlayer::stop()
+    {
+        return _detail->post(PlayerCommandType::Stop);
+    }
+    
+    bool MidiSongPlayer::pause()
+    {
+        return _detail->post(PlayerCommandType::Pause);
+    }
+    
+    bool MidiSongPlayer::resume()
+    {
+        return _detail->post(PlayerCommandType::Resume);
+    }
+    
+    bool MidiSongPlayer::seekNs(int64_t songTime)
+    {
+        return _detail->post(PlayerCommandType::Seek, songTime);
+    }
+    
+    bool MidiSongPlayer::seek(float songTime)
+    {
+        return seekNs(secondsToNanoseconds(songTime));
+    }
+    
+    bool MidiSongPlayer::setSpeed(float speed)
+    {
+        return _detail->post(PlayerCommandType::Speed, 0, speed);
+    }
+    
+    bool MidiSongPlayer::setMute(bool mute)
+    {
+        return _detail->post(PlayerCommandType::Mute, 0, mute ? 1 : 0);
+    }
+    
+    void MidiSongPlayer::updateNs(int64_t wallclockTime)
     {
         _detail->update(wallclockTime);
     }
     
+    void MidiSongPlayer::update(float wallclockTime)
+    {
+        _detail->update(secondsToNanoseconds(wallclockTime));
+    }
+    
+    void MidiSongPlayer::freewheelNs(int64_t songTimeLimit)
+    {
+        _detail->freewheel(songTimeLimit);
+    }
+    
+    void MidiSongPlayer::freewheel(float songTimeLimit)
+    {
+        _detail->freewheel(secondsToNanoseconds(songTimeLimit));
+    }
+    
+    int64_t MidiSongPlayer::lengthNs() const
+    {
+        int64_t t = _detail->events.empty() ? 0 : _detail->events.back().timeNs;
+        if (!_detail->meta.empty())
+            t = std::max(t, _detail->meta.back().timeNs);
+        return t;
+    }
+    
     float MidiSongPlayer::length() const
     {
-        return _detail->events.back().time;
+        return nanosecondsToSeconds(lengthNs());
     }
     
-    void MidiSongPlayer::addCallback(MidiEventCallbackFn f, void* userData)
+    int64_t MidiSongPlayer::nextEventTimeNs() const
     {
-        _detail->callbacks.push_back(std::pair<void*, MidiEventCallbackFn>(userData, f));
+        return _detail->nextEventTime();
     }
     
-    void MidiSongPlayer::removeCallback(void* userData)
+    float MidiSongPlayer::nextEventTime() const
     {
-        std::vector<std::pair<void*, MidiEventCallbackFn> >::iterator i = _detail->callbacks.begin();
-        while (i != _detail->callbacks.end()) {
-            if (userData == (*i).first) {
-                _detail->callbacks.erase(i);
-                i = _detail->callbacks.begin();
-            }
-            else
-                ++i;
+        return nanosecondsToSeconds(_detail->nextEventTime());
+    }
+    
+    bool MidiSongPlayer::atEnd() const
+    {
+        return _detail->eventCursor >= _detail->events.size() && _detail->metaCursor >= _detail->meta.size();
+    }
+    
+    void MidiSongPlayer::setTrackMute(int track, bool mute)
+    {
+        if (track >= 0)
+            setMaskBit(_detail->trackMute, std::min(track, 63), mute);
+    }
+    
+    void MidiSongPlayer::setTrackSolo(int track, bool solo)
+    {
+        if (track >= 0)
+            setMaskBit(_detail->trackSolo, std::min(track, 63), solo);
+    }
+    
+    void MidiSongPlayer::setChannelMute(int channel, bool mute)
+    {
+        if (channel >= 0 && channel < 16)
+            setMaskBit(_detail->channelMute, channel, mute);
+    }
+    
+    void MidiSongPlayer::setChannelSolo(int channel, bool solo)
+    {
+        if (channel >= 0 && channel < 16)
+            setMaskBit(_detail->channelSolo, channel, solo);
+    }
+    
+    size_t MidiSongPlayer::metaEventCount() const
+    {
+        return _detail->meta.size();
+    }
+    
+    const MidiMetaEvent* MidiSongPlayer::metaEvents() const
+    {
+        return _detail->meta.data();
+    }
+    
+    bool MidiSongPlayer::setMetaCallback(MidiMetaCallbackFn f, void* userData)
+    {
+        PlayerCommand c;
+        c.type = PlayerCommandType::MetaCallback;
+        c.metaFn = f;
+        c.userData = userData;
+        return _detail->commands.push(c);
+    }
+    
+    const MidiMetaEvent* MidiSongPlayer::nextMetaEventNs(Midi_MetaEventType type, int64_t songTime) const
+    {
+        return _detail->nextMeta(type, songTime);
+    }
+    
+    const MidiMetaEvent* MidiSongPlayer::nextMetaEvent(Midi_MetaEventType type, float songTime) const
+    {
+        return _detail->nextMeta(type, secondsToNanoseconds(songTime));
+    }
+    
+    const MidiMetaEvent* MidiSongPlayer::findMetaEvent(Midi_MetaEventType type, char const*const name) const
+    {
+        return name ? _detail->findMeta(type, std::string_view(name)) : nullptr;
+    }
+    
+    void MidiSongPlayer::setInstrumented(bool enable)
+    {
+        if (enable && !_detail->histograms.load()) {
+            DispatchHistograms* h = new DispatchHistograms();
+            DispatchHistograms* expected = nullptr;
+            if (!_detail->histograms.compare_exchange_strong(expected, h))
+                delete h;
         }
+        _detail->instrumented = enable;
+    }
+    
+    MidiDispatchStats MidiSongPlayer::dispatchStats() const
+    {
+        MidiDispatchStats stats;
+        DispatchHistograms* h = _detail->histograms.load(std::memory_order_acquire);
+        if (!h)
+            return stats;
+        
+        stats.updates = h->eventsPerUpdate.samples();
+        stats.events = h->lateness.samples();
+        stats.latenessP50Ns = h->lateness.percentile(0.5);
+        stats.latenessP99Ns = h->lateness.percentile(0.99);
+        stats.latenessP999Ns = h->lateness.percentile(0.999);
+        stats.latenessMaxNs = h->lateness.max();
+        stats.eventsPerUpdateMean = h->eventsPerUpdate.mean();
+        stats.eventsPerUpdateMax = h->eventsPerUpdate.max();
+        stats.sinkTimeP50Ns = h->sinkTime.percentile(0.5);
+        stats.sinkTimeP99Ns = h->sinkTime.percentile(0.99);
+        stats.sinkTimeMaxNs = h->sinkTime.max();
+        return stats;
+    }
+    
+    void MidiSongPlayer::resetDispatchStats()
+    {
+        DispatchHistograms* h = _detail->histograms.load(std::memory_order_acquire);
+        if (h) {
+            h->lateness.reset();
+            h->eventsPerUpdate.reset();
+            h->sinkTime.reset();
+        }
+    }
+    
+    bool MidiSongPlayer::writeDispatchStats(char const*const path) const
+    {
+        FILE* f = fopen(path, "w");
+        if (!f)
+            return false;
+        
+        MidiDispatchStats stats = dispatchStats();
+        fprintf(f, "updates %llu\n", (unsigned long long) stats.updates);
+        fprintf(f, "events %llu\n", (unsigned long long) stats.events);
+        fprintf(f, "lateness_ns p50 %lld p99 %lld p999 %lld max %lld\n",
+                (long long) stats.latenessP50Ns, (long long) stats.latenessP99Ns,
+                (long long) stats.latenessP999Ns, (long long) stats.latenessMaxNs);
+        fprintf(f, "events_per_update mean %f max %lld\n",
+                stats.eventsPerUpdateMean, (long long) stats.eventsPerUpdateMax);
+        fprintf(f, "sink_time_ns p50 %lld p99 %lld max %lld\n",
+                (long long) stats.sinkTimeP50Ns, (long long) stats.sinkTimeP99Ns,
+                (long long) stats.sinkTimeMaxNs);
+        
+        // the full histograms follow, one bucket per line as low high count
+        DispatchHistograms* h = _detail->histograms.load(std::memory_order_acquire);
+        if (h) {
+            fprintf(f, "\nlateness_ns\n");
+            h->lateness.write(f);
+            fprintf(f, "\nevents_per_update\n");
+            h->eventsPerUpdate.write(f);
+            fprintf(f, "\nsink_time_ns\n");
+            h->sinkTime.write(f);
+        }
+        
+        bool ok = !ferror(f);
+        fclose(f);
+        return ok;
+    }
+    
+    bool MidiSongPlayer::addSink(MidiEventSink* sink)
+    {
+        if (!sink)
+            return false;
+        _detail->sinks.add(Detail::SinkEntry{ sink, nullptr });
+        return true;
+    }
+    
+    bool MidiSongPlayer::removeSink(MidiEventSink* sink)
+    {
+        _detail->sinks.removeIf([sink](const Detail::SinkEntry& e) { return e.sink == sink && !e.adapter; });
+        _detail->sinks.synchronize();
+        return true;
+    }
+    
+    bool MidiSongPlayer::addCallback(MidiEventCallbackFn f, void* userData)
+    {
+        if (!f)
+            return false;
+        auto adapter = std::make_shared<MidiCallbackSink>(f, userData);
+        _detail->sinks.add(Detail::SinkEntry{ adapter.get(), adapter });
+        return true;
+    }
+    
+    bool MidiSongPlayer::removeCallback(void* userData)
+    {
+        _detail->sinks.removeIf([userData](const Detail::SinkEntry& e) { return e.adapter && e.adapter->userData == userData; });
+        _detail->sinks.synchronize();
+        return true;
     }
     
 } // Lab
@@ -32,9 +32,16 @@
 
 #include "LabMidi/Util.h"
 
+#include <chrono>
 #include <ctype.h>
 #include <math.h>
 #include <string.h>
+#include <thread>
+
+#if defined(__linux__)
+#include <errno.h>
+#include <time.h>
+#endif
 
 namespace Lab {
     
@@ -440,5 +447,32 @@ namespace Lab {
         if (bpm >= 20) return "Grave";              //   40-20
         return "Larghissimo";                       //    0-20
     }
+
+    int64_t monotonicNanoseconds()
+    {
+#if defined(__linux__)
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+#else
+        using namespace std::chrono;
+        return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    void sleepUntilNanoseconds(int64_t deadline)
+    {
+#if defined(__linux__)
+        timespec ts;
+        ts.tv_sec = time_t(deadline / 1000000000);
+        ts.tv_nsec = long(deadline % 1000000000);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
+            ;
+#else
+        using namespace std::chrono;
+        std::this_thread::sleep_until(steady_clock::time_point(
+            duration_cast<steady_clock::duration>(nanoseconds(deadline))));
+#endif
+    }
     
 } // Lab
@@ -0,0 +1,137 @@
+//
+//  ActiveNoteTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks that MidiSongPlayer releases the notes sounding when it stops,
+// pauses, seeks, or is muted, and strikes them again when it resumes.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    const int64_t ms = 1000000;
+
+    // three notes sounding from the start until 100 milliseconds
+    void buildChord(MidiSong& song)
+    {
+        Track track = {
+            { 0, { MIDI_NOTE_ON, 60, 100 } },
+            { 0, { MIDI_NOTE_ON, 64, 90 } },
+            { 5, { MIDI_NOTE_ON | 1, 62, 80 } },
+            { 100, { MIDI_NOTE_OFF, 60, 0 } },
+            { 100, { MIDI_NOTE_ON, 64, 0 } },
+            { 100, { MIDI_NOTE_OFF | 1, 62, 0 } },
+        };
+        buildSong(song, { track });
+    }
+
+    const std::vector<Bytes> offs = {
+        { MIDI_NOTE_OFF, 60, 0 },
+        { MIDI_NOTE_OFF, 64, 0 },
+        { MIDI_NOTE_OFF | 1, 62, 0 },
+    };
+
+    void testStop()
+    {
+        MidiSong song;
+        buildChord(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+
+        player.updateNs(10 * ms);
+        CHECK(log.received.size() == 3);
+        log.clear();
+        CHECK(player.stop());
+        player.updateNs(11 * ms);
+        CHECK(log.commands() == offs);
+
+        // nothing more once stopped, and nothing to release again
+        player.updateNs(200 * ms);
+        CHECK(player.stop());
+        player.updateNs(201 * ms);
+        CHECK(log.commands() == offs);
+    }
+
+    void testSeek()
+    {
+        MidiSong song;
+        buildChord(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+
+        player.updateNs(10 * ms);
+        log.clear();
+        CHECK(player.seekNs(150 * ms));
+        player.updateNs(20 * ms);
+        CHECK(log.commands() == offs);
+        CHECK(player.atEnd());
+    }
+
+    void testPauseResume()
+    {
+        MidiSong song;
+        buildChord(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+
+        player.updateNs(10 * ms);
+        log.clear();
+        CHECK(player.pause());
+        player.updateNs(20 * ms);
+        CHECK(log.commands() == offs);
+
+        log.clear();
+        CHECK(player.resume());
+        player.updateNs(30 * ms);
+        std::vector<Bytes> strikes = {
+            { MIDI_NOTE_ON, 60, 100 },
+            { MIDI_NOTE_ON, 64, 90 },
+            { MIDI_NOTE_ON | 1, 62, 80 },
+        };
+        CHECK(log.commands() == strikes);
+
+        // the song's own note offs end them, leaving nothing to release
+        player.updateNs(200 * ms);
+        log.clear();
+        CHECK(player.stop());
+        player.updateNs(201 * ms);
+        CHECK(log.received.empty());
+    }
+
+    void testMute()
+    {
+        MidiSong song;
+        buildChord(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+
+        player.updateNs(10 * ms);
+        log.clear();
+        CHECK(player.setMute(true));
+        player.updateNs(20 * ms);
+        CHECK(log.commands() == offs);
+        player.updateNs(200 * ms);
+        CHECK(log.commands() == offs);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testStop();
+    testSeek();
+    testPauseResume();
+    testMute();
+    return finish();
+}
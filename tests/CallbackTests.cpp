@@ -0,0 +1,161 @@
+//
+//  CallbackTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks that MidiIn's and MidiSongPlayer's callbacks and sinks may be
+// removed while messages are being delivered, including from within a
+// callback, and that none is called once its removal has returned.
+
+#include "LabMidiTest.h"
+#include <atomic>
+#include <thread>
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    // A's callback forwards to B, whose callback removes A's, so the
+    // removal happens within reads of two lists of the same type
+    struct Nested {
+        MidiIn* a;
+        MidiLoopbackOut* toB;
+        int aCalls = 0;
+        int bCalls = 0;
+    };
+
+    void nestedA(void* userData, MidiCommand* mc)
+    {
+        Nested* n = (Nested*) userData;
+        ++n->aCalls;
+        n->toB->command(mc);
+    }
+
+    void nestedB(void* userData, MidiCommand*)
+    {
+        Nested* n = (Nested*) userData;
+        ++n->bCalls;
+        n->a->removeCallback(n);
+    }
+
+    void testNestedRemoval()
+    {
+        MidiIn a;
+        MidiIn b;
+        MidiLoopbackOut toA(&a);
+        MidiLoopbackOut toB(&b);
+        Nested n;
+        n.a = &a;
+        n.toB = &toB;
+        a.addCallback(nestedA, &n);
+        b.addCallback(nestedB, &n);
+
+        MidiCommand mc(MIDI_NOTE_ON, 60, 100);
+        toA.command(&mc);
+        toA.command(&mc);
+        CHECK(n.aCalls == 1);
+        CHECK(n.bCalls == 1);
+        b.removeCallback(&n);
+    }
+
+    struct Counted {
+        std::atomic<int> calls { 0 };
+        std::atomic<bool> removed { false };
+        std::atomic<bool> late { false };
+    };
+
+    void countCall(void* userData, MidiCommand*)
+    {
+        Counted* c = (Counted*) userData;
+        if (c->removed.load())
+            c->late.store(true);
+        ++c->calls;
+    }
+
+    void testRemovalWhileDelivering()
+    {
+        MidiIn in;
+        MidiLoopbackOut out(&in);
+        Counted c;
+        in.addCallback(countCall, &c);
+
+        std::atomic<bool> quit { false };
+        std::thread sender([&]() {
+            MidiCommand mc(MIDI_CONTROL_CHANGE, 1, 1);
+            while (!quit.load())
+                out.command(&mc);
+        });
+        while (c.calls.load() < 100)
+            std::this_thread::yield();
+        in.removeCallback(&c);
+        c.removed.store(true);
+        int calls = c.calls.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        quit.store(true);
+        sender.join();
+        CHECK(!c.late.load());
+        CHECK(c.calls.load() == calls);
+    }
+
+    struct CountedSink : public MidiEventSink {
+        Counted c;
+        virtual void events(const MidiRtEvent*, size_t)
+        {
+            countCall(&c, nullptr);
+        }
+    };
+
+    void countedEvent(void* userData, MidiRtEvent*)
+    {
+        countCall(userData, nullptr);
+    }
+
+    void testPlayerRemoval()
+    {
+        // a controller change every millisecond for ten seconds
+        Track track;
+        for (int64_t ms = 0; ms < 10000; ++ms)
+            track.push_back(TimedBytes{ ms, { MIDI_CONTROL_CHANGE, 1, uint8_t(ms & 0x7f) } });
+        MidiSong song;
+        buildSong(song, { track });
+        MidiSongPlayer player(&song);
+        CountedSink sink;
+        Counted c;
+        player.addSink(&sink);
+        player.addCallback(countedEvent, &c);
+
+        std::atomic<bool> quit { false };
+        std::thread updater([&]() {
+            for (int64_t ms = 0; !quit.load() && ms < 10000; ++ms)
+                player.updateNs(ms * 1000000);
+        });
+        while (sink.c.calls.load() < 100 || c.calls.load() < 100)
+            std::this_thread::yield();
+        player.removeSink(&sink);
+        sink.c.removed.store(true);
+        player.removeCallback(&c);
+        c.removed.store(true);
+        int sinkCalls = sink.c.calls.load();
+        int calls = c.calls.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        quit.store(true);
+        updater.join();
+        CHECK(!sink.c.late.load());
+        CHECK(!c.late.load());
+        CHECK(sink.c.calls.load() == sinkCalls);
+        CHECK(c.calls.load() == calls);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testNestedRemoval();
+    testRemovalWhileDelivering();
+    testPlayerRemoval();
+    return finish();
+}
@@ -0,0 +1,134 @@
+//
+//  CoalescingTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiIn's coalescing, which drops controller values that have
+// backed up in the queue behind a later value for the same controller.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    void send(MidiLoopbackOut& out, uint8_t command, uint8_t byte1, uint8_t byte2)
+    {
+        MidiCommand mc(command, byte1, byte2);
+        out.command(&mc);
+    }
+
+    std::vector<Bytes> drainAll(MidiIn& in)
+    {
+        std::vector<Bytes> received;
+        MidiInMessage batch[64];
+        size_t n = in.drain(batch, 64);
+        for (size_t i = 0; i < n; ++i)
+            received.push_back(Bytes(batch[i].data, batch[i].data + batch[i].size));
+        return received;
+    }
+
+    void testBacklog()
+    {
+        MidiIn in;
+        in.enableQueue(64, 1024);
+        in.setCoalescing(1000000000);
+        MidiLoopbackOut out(&in);
+
+        send(out, MIDI_CONTROL_CHANGE, 7, 1);          // dropped
+        send(out, MIDI_CONTROL_CHANGE, 7, 2);          // dropped
+        send(out, MIDI_CONTROL_CHANGE | 1, 7, 2);      // another channel
+        send(out, MIDI_CONTROL_CHANGE, 7, 3);
+        send(out, MIDI_PITCH_BEND, 0, 10);             // dropped
+        send(out, MIDI_PITCH_BEND, 0, 20);
+        send(out, MIDI_NOTE_ON, 60, 100);              // a barrier
+        send(out, MIDI_CONTROL_CHANGE, 7, 4);          // dropped
+        send(out, MIDI_CONTROL_CHANGE, 7, 5);
+        send(out, MIDI_CONTROL_CHANGE, 0, 1);          // bank select is kept
+        send(out, MIDI_CONTROL_CHANGE, 0, 1);
+        Bytes dump = sysex(20, 1);
+        out.send(dump.data(), dump.size());
+
+        std::vector<Bytes> expected = {
+            { MIDI_CONTROL_CHANGE | 1, 7, 2 },
+            { MIDI_CONTROL_CHANGE, 7, 3 },
+            { MIDI_PITCH_BEND, 0, 20 },
+            { MIDI_NOTE_ON, 60, 100 },
+            { MIDI_CONTROL_CHANGE, 7, 5 },
+            { MIDI_CONTROL_CHANGE, 0, 1 },
+            { MIDI_CONTROL_CHANGE, 0, 1 },
+            dump,
+        };
+        CHECK(drainAll(in) == expected);
+        CHECK(in.coalescedDropped() == 4);
+        CHECK(in.coalescedDelivered() == 8);
+
+        // a value isn't held back for one that may follow, so a consumer
+        // that keeps up receives every value
+        send(out, MIDI_CONTROL_CHANGE, 7, 6);
+        CHECK(drainAll(in).size() == 1);
+        send(out, MIDI_CONTROL_CHANGE, 7, 7);
+        CHECK(drainAll(in).size() == 1);
+        CHECK(in.coalescedDropped() == 4);
+    }
+
+    void testDisabled()
+    {
+        MidiIn in;
+        in.enableQueue(64, 1024);
+        MidiLoopbackOut out(&in);
+        for (int i = 0; i < 10; ++i)
+            send(out, MIDI_CONTROL_CHANGE, 7, uint8_t(i));
+        CHECK(drainAll(in).size() == 10);
+        CHECK(in.coalescedDropped() == 0);
+    }
+
+    int directCalls = 0;
+
+    void countDirect(void*, MidiCommand*)
+    {
+        ++directCalls;
+    }
+
+    void testDispatch()
+    {
+        MidiIn in;
+        in.enableQueue(64, 1024);
+        in.setCoalescing(1000000000);
+        in.addCallback(countDirect, nullptr);
+        MidiLoopbackOut out(&in);
+        for (int i = 0; i < 10; ++i)
+            send(out, MIDI_CHANNEL_PRESSURE, uint8_t(i), 0);
+        directCalls = 0;
+        CHECK(in.dispatch() == 1);
+        CHECK(directCalls == 1);
+    }
+
+    void testDirect()
+    {
+        // without the queue, nothing backs up, so nothing is dropped
+        MidiIn in;
+        in.setCoalescing(1000000000);
+        in.addCallback(countDirect, nullptr);
+        MidiLoopbackOut out(&in);
+        directCalls = 0;
+        for (int i = 0; i < 10; ++i)
+            send(out, MIDI_CONTROL_CHANGE, 7, uint8_t(i));
+        CHECK(directCalls == 10);
+        CHECK(in.coalescedDropped() == 0);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testBacklog();
+    testDisabled();
+    testDispatch();
+    testDirect();
+    return finish();
+}
@@ -0,0 +1,74 @@
+//
+//  FilterRedundantTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiOut's redundant message filter, which drops controller,
+// program, and pressure messages that would leave a channel as it was.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    void testFilterRedundant()
+    {
+        MidiIn in;
+        in.enableQueue(64, 1024);
+        MidiOut out;
+        CHECK(out.openLoopbackPort(&in));
+        out.setFilterRedundant(true);
+
+        out.sendControlChange(0, 7, 100);
+        out.sendControlChange(0, 7, 100);      // suppressed
+        out.sendControlChange(0, 6, 10);       // data entry always passes
+        out.sendControlChange(0, 6, 10);
+        out.sendProgramChange(0, 5);
+        out.sendProgramChange(0, 5);           // suppressed
+        out.sendControlChange(0, 0, 1);        // bank select forgets the program
+        out.sendProgramChange(0, 5);
+        out.sendPitchBend(1, 0, 64);
+        out.sendPitchBend(1, 0, 64);           // suppressed
+        out.sendNoteOn(0, 60, 100);
+        out.sendNoteOn(0, 60, 100);            // notes always pass
+
+        MidiCommand volume(MIDI_CONTROL_CHANGE, 7, 100);
+        out.resend(&volume);
+
+        MidiCommand batch[2] = { MidiCommand(MIDI_CONTROL_CHANGE | 2, 10, 64),
+                                 MidiCommand(MIDI_CONTROL_CHANGE | 2, 10, 64) };
+        out.send(batch, 2);                    // second suppressed
+
+        out.resetFilter();
+        out.sendControlChange(0, 7, 100);
+
+        std::vector<Bytes> expected = {
+            { MIDI_CONTROL_CHANGE, 7, 100 },
+            { MIDI_CONTROL_CHANGE, 6, 10 },
+            { MIDI_CONTROL_CHANGE, 6, 10 },
+            { MIDI_PROGRAM_CHANGE, 5 },
+            { MIDI_CONTROL_CHANGE, 0, 1 },
+            { MIDI_PROGRAM_CHANGE, 5 },
+            { MIDI_PITCH_BEND | 1, 0, 64 },
+            { MIDI_NOTE_ON, 60, 100 },
+            { MIDI_NOTE_ON, 60, 100 },
+            { MIDI_CONTROL_CHANGE, 7, 100 },
+            { MIDI_CONTROL_CHANGE | 2, 10, 64 },
+            { MIDI_CONTROL_CHANGE, 7, 100 },
+        };
+        CHECK(readAll(in) == expected);
+        CHECK(out.filteredCount() == 4);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testFilterRedundant();
+    return finish();
+}
@@ -0,0 +1,128 @@
+//
+//  FreewheelTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiSongPlayer's freewheel rendering, which dispatches a song
+// faster than real time, one group of simultaneous events at a time.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    const int64_t ms = 1000000;
+
+    // a chord at the start, then a note every ten seconds, so that
+    // rendering in real time would take a minute
+    void buildSlow(MidiSong& song)
+    {
+        Track track = {
+            { 0, { MIDI_NOTE_ON, 60, 100 } },
+            { 0, { MIDI_NOTE_ON, 64, 100 } },
+        };
+        for (int i = 1; i <= 6; ++i)
+            track.push_back(TimedBytes{ i * 10000, { MIDI_NOTE_ON, uint8_t(60 + i), 100 } });
+        buildSong(song, { track });
+    }
+
+    std::vector<int64_t> times(const EventLog& log)
+    {
+        std::vector<int64_t> t;
+        for (const MidiRtEvent& ev : log.received)
+            t.push_back(ev.timeNs);
+        return t;
+    }
+
+    int metaCount = 0;
+
+    void countMeta(void*, const MidiMetaEvent*)
+    {
+        ++metaCount;
+    }
+
+    void testRender()
+    {
+        MidiSong song;
+        buildSlow(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+        metaCount = 0;
+        player.setMetaCallback(countMeta, nullptr);
+
+        int64_t start = monotonicNanoseconds();
+        player.freewheelNs();
+        CHECK(monotonicNanoseconds() - start < 1000000000);
+        CHECK(player.atEnd());
+
+        // each group of simultaneous events in its own batch, at its song time
+        CHECK(log.batches == std::vector<size_t>({ 2, 1, 1, 1, 1, 1, 1 }));
+        std::vector<int64_t> expected = { 0, 0 };
+        for (int i = 1; i <= 6; ++i)
+            expected.push_back(i * 10000 * ms);
+        CHECK(times(log) == expected);
+        CHECK(metaCount == 1);                  // the tempo
+    }
+
+    void testLimit()
+    {
+        MidiSong song;
+        buildSlow(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+
+        player.freewheelNs(25000 * ms);
+        CHECK(times(log) == std::vector<int64_t>({ 0, 0, 10000 * ms, 20000 * ms }));
+        CHECK(!player.atEnd());
+
+        // rendering continues from where it stopped
+        log.clear();
+        player.freewheel(45.f);
+        CHECK(times(log) == std::vector<int64_t>({ 30000 * ms, 40000 * ms }));
+    }
+
+    void testRestart()
+    {
+        MidiSong song;
+        buildSlow(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+
+        // a stopped player renders from the beginning
+        player.freewheelNs(15000 * ms);
+        CHECK(player.stop());
+        player.updateNs(0);
+        log.clear();
+        player.freewheelNs(5000 * ms);
+        CHECK(times(log) == std::vector<int64_t>({ 0, 0 }));
+
+        // a paused one resumes where it paused
+        CHECK(player.pause());
+        player.updateNs(0);
+        log.clear();
+        player.freewheelNs(15000 * ms);
+        std::vector<Bytes> expected = {
+            { MIDI_NOTE_ON, 60, 100 },          // struck again on resuming
+            { MIDI_NOTE_ON, 64, 100 },
+            { MIDI_NOTE_ON, 61, 100 },
+        };
+        CHECK(log.commands() == expected);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testRender();
+    testLimit();
+    testRestart();
+    return finish();
+}
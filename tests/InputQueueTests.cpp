@@ -0,0 +1,67 @@
+//
+//  InputQueueTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiIn's queue, through which messages pass from the receive
+// thread to a consumer, including SysEx spilled to its byte ring.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    void testInputQueue()
+    {
+        MidiIn in;
+        in.enableQueue(8, 64);
+        MidiLoopbackOut out(&in);
+
+        // messages beyond the capacity are dropped and counted
+        for (int i = 0; i < 10; ++i) {
+            MidiCommand mc(MIDI_NOTE_ON, uint8_t(i), 100);
+            out.command(&mc);
+        }
+        std::vector<Bytes> received = readAll(in);
+        CHECK(received.size() == 8);
+        for (size_t i = 0; i < received.size(); ++i)
+            CHECK(received[i] == Bytes({ MIDI_NOTE_ON, uint8_t(i), 100 }));
+        CHECK(in.queueOverflows() == 2);
+
+        // SysEx too long for a record is spilled, and read back whole
+        Bytes a = sysex(30, 1);
+        Bytes b = sysex(30, 2);
+        Bytes c = sysex(30, 3);
+        out.send(a.data(), a.size());
+        out.send(b.data(), b.size());
+        out.send(c.data(), c.size());      // no room until a and b are read
+        received = readAll(in);
+        CHECK(received.size() == 2);
+        CHECK(received.size() == 2 && received[0] == a && received[1] == b);
+        CHECK(in.queueOverflows() == 3);
+
+        // once read, the spill space is reused, wrapping around the end
+        out.send(c.data(), c.size());
+        out.send(a.data(), a.size());
+        received = readAll(in);
+        CHECK(received.size() == 2 && received[0] == c && received[1] == a);
+
+        // SysEx larger than the spill space can never be queued
+        Bytes big = sysex(100, 4);
+        out.send(big.data(), big.size());
+        CHECK(readAll(in).empty());
+        CHECK(in.queueOverflows() == 4);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testInputQueue();
+    return finish();
+}
@@ -0,0 +1,148 @@
+//
+//  LabMidiTest.h
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// A minimal harness shared by the tests. Each test is a program that runs
+// its checks in process, through loopback ports where it needs MIDI, so
+// that no MIDI hardware or OS MIDI service is needed, and returns non zero
+// if any check failed.
+
+#pragma once
+
+#include "LabMidi/LabMidi.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+namespace LabMidiTest {
+
+    inline int failures = 0;
+
+    inline void check(bool ok, const char* expr, const char* file, int line)
+    {
+        if (!ok) {
+            ++failures;
+            printf("%s:%d: check failed: %s\n", file, line, expr);
+        }
+    }
+
+#define CHECK(expr) LabMidiTest::check((expr), #expr, __FILE__, __LINE__)
+
+    // reports the result, and returns the program's exit code
+    inline int finish()
+    {
+        if (failures)
+            printf("%d checks failed\n", failures);
+        else
+            printf("all checks passed\n");
+        return failures ? 1 : 0;
+    }
+
+    typedef std::vector<uint8_t> Bytes;
+
+    // Reads everything queued at a MidiIn
+    inline std::vector<Bytes> readAll(Lab::MidiIn& in)
+    {
+        std::vector<Bytes> received;
+        Lab::MidiInMessage msg;
+        while (in.read(msg))
+            received.push_back(Bytes(msg.data, msg.data + msg.size));
+        return received;
+    }
+
+    // A SysEx message of size bytes, including the F0 and F7
+    inline Bytes sysex(size_t size, uint8_t seed)
+    {
+        Bytes b(size);
+        b.front() = MIDI_SYSTEM_EXCLUSIVE;
+        for (size_t i = 1; i + 1 < size; ++i)
+            b[i] = uint8_t(seed + i) & 0x7f;
+        b.back() = MIDI_EOX;
+        return b;
+    }
+
+    // A sink that keeps every event it receives, and the size of each batch
+    struct EventLog : public Lab::MidiEventSink {
+        std::vector<Lab::MidiRtEvent> received;
+        std::vector<size_t> batches;
+
+        virtual void events(const Lab::MidiRtEvent* ev, size_t count)
+        {
+            received.insert(received.end(), ev, ev + count);
+            batches.push_back(count);
+        }
+
+        // the three bytes of each event received
+        std::vector<Bytes> commands() const
+        {
+            std::vector<Bytes> c;
+            for (const Lab::MidiRtEvent& ev : received)
+                c.push_back({ ev.command.command, ev.command.byte1, ev.command.byte2 });
+            return c;
+        }
+
+        void clear()
+        {
+            received.clear();
+            batches.clear();
+        }
+    };
+
+    // A message in a track, at a time in milliseconds. The bytes are as
+    // they appear in a file after the delta time, so a meta event is
+    // FF, its type, its length, and its data.
+    struct TimedBytes {
+        int64_t ms;
+        Bytes bytes;
+    };
+
+    typedef std::vector<TimedBytes> Track;
+
+    // Builds a song by writing a Standard MIDI file and parsing it. The
+    // first track sets a tempo of 60 beats per minute, and there are a
+    // thousand ticks per beat, so a tick is a millisecond.
+    inline void buildSong(Lab::MidiSong& song, std::vector<Track> tracks)
+    {
+        auto put32 = [](Bytes& b, uint32_t v) {
+            for (int shift = 24; shift >= 0; shift -= 8)
+                b.push_back(uint8_t(v >> shift));
+        };
+        Bytes file = { 'M', 'T', 'h', 'd' };
+        put32(file, 6);
+        file.insert(file.end(), { 0, 1, 0, uint8_t(tracks.size()), 0x03, 0xe8 });
+        if (!tracks.empty())
+            tracks[0].insert(tracks[0].begin(), TimedBytes{ 0, { 0xff, 0x51, 3, 0x0f, 0x42, 0x40 } });
+        for (Track& track : tracks) {
+            std::stable_sort(track.begin(), track.end(),
+                             [](const TimedBytes& a, const TimedBytes& b) { return a.ms < b.ms; });
+            track.push_back(TimedBytes{ track.empty() ? 0 : track.back().ms, { 0xff, 0x2f, 0 } });
+            Bytes chunk;
+            int64_t last = 0;
+            for (const TimedBytes& ev : track) {
+                uint32_t delta = uint32_t(ev.ms - last);
+                last = ev.ms;
+                uint8_t v[5];
+                int n = 0;
+                do {
+                    v[n++] = delta & 0x7f;
+                    delta >>= 7;
+                } while (delta);
+                while (n > 1)
+                    chunk.push_back(v[--n] | 0x80);
+                chunk.push_back(v[0]);
+                chunk.insert(chunk.end(), ev.bytes.begin(), ev.bytes.end());
+            }
+            file.insert(file.end(), { 'M', 'T', 'r', 'k' });
+            put32(file, uint32_t(chunk.size()));
+            file.insert(file.end(), chunk.begin(), chunk.end());
+        }
+        song.parse(file.data(), file.size(), false);
+    }
+
+} // LabMidiTest
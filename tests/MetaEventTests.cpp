@@ -0,0 +1,149 @@
+//
+//  MetaEventTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiSongPlayer's meta event timeline: the events and their
+// bytes, the lookups by time and by name, and delivery to the meta
+// callback.
+
+#include "LabMidiTest.h"
+#include <string>
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    const int64_t ms = 1000000;
+
+    Bytes text(Midi_MetaEventType type, const std::string& s)
+    {
+        Bytes b = { 0xff, uint8_t(type), uint8_t(s.size()) };
+        b.insert(b.end(), s.begin(), s.end());
+        return b;
+    }
+
+    std::string text(const MidiMetaEvent* m)
+    {
+        return m ? std::string((const char*) m->data, m->size) : std::string();
+    }
+
+    void buildMarked(MidiSong& song)
+    {
+        Track first = {
+            { 10, text(Midi_MetaEventType::MARKER, "intro") },
+            { 15, { MIDI_NOTE_ON, 60, 100 } },
+            { 20, text(Midi_MetaEventType::LYRIC, "la") },
+            { 30, text(Midi_MetaEventType::MARKER, "verse") },
+            { 40, text(Midi_MetaEventType::MARKER, "intro") },
+            { 50, { MIDI_NOTE_OFF, 60, 0 } },
+        };
+        Track second = {
+            { 0, { 0xff, 0x58, 4, 4, 2, 24, 8 } },
+            { 25, text(Midi_MetaEventType::CUE, "go") },
+        };
+        buildSong(song, { first, second });
+    }
+
+    void testTimeline()
+    {
+        MidiSong song;
+        buildMarked(song);
+        MidiSongPlayer player(&song);
+
+        // the tempo and time signature, then the text events; end of
+        // track markers are left out
+        CHECK(player.metaEventCount() == 7);
+        const MidiMetaEvent* m = player.metaEvents();
+        bool ordered = true;
+        for (size_t i = 1; i < player.metaEventCount(); ++i)
+            ordered = ordered && m[i - 1].timeNs <= m[i].timeNs;
+        CHECK(ordered);
+
+        const MidiMetaEvent* tempo = player.nextMetaEventNs(Midi_MetaEventType::TEMPO_CHANGE, -1);
+        CHECK(tempo && tempo->timeNs == 0 && tempo->track == 0);
+        CHECK(tempo && tempo->size == 3 && Bytes(tempo->data, tempo->data + 3) == Bytes({ 0x0f, 0x42, 0x40 }));
+        const MidiMetaEvent* signature = player.nextMetaEventNs(Midi_MetaEventType::TIME_SIGNATURE, -1);
+        CHECK(signature && signature->track == 1 && signature->size == 4);
+
+        const MidiMetaEvent* cue = player.nextMetaEventNs(Midi_MetaEventType::CUE, 0);
+        CHECK(cue && cue->timeNs == 25 * ms && cue->track == 1 && text(cue) == "go");
+    }
+
+    void testLookups()
+    {
+        MidiSong song;
+        buildMarked(song);
+        MidiSongPlayer player(&song);
+
+        // strictly after the time given
+        const MidiMetaEvent* m = player.nextMetaEventNs(Midi_MetaEventType::MARKER, 0);
+        CHECK(m && m->timeNs == 10 * ms && text(m) == "intro");
+        m = player.nextMetaEventNs(Midi_MetaEventType::MARKER, 10 * ms);
+        CHECK(m && m->timeNs == 30 * ms && text(m) == "verse");
+        CHECK(!player.nextMetaEventNs(Midi_MetaEventType::MARKER, 40 * ms));
+        m = player.nextMetaEvent(Midi_MetaEventType::LYRIC, 0.f);
+        CHECK(m && text(m) == "la");
+
+        // the earliest of the name
+        m = player.findMetaEvent(Midi_MetaEventType::MARKER, "intro");
+        CHECK(m && m->timeNs == 10 * ms);
+        m = player.findMetaEvent(Midi_MetaEventType::MARKER, "verse");
+        CHECK(m && m->timeNs == 30 * ms);
+        CHECK(!player.findMetaEvent(Midi_MetaEventType::MARKER, "coda"));
+        CHECK(!player.findMetaEvent(Midi_MetaEventType::LYRIC, "intro"));
+        m = player.findMetaEvent(Midi_MetaEventType::CUE, "go");
+        CHECK(m && m->track == 1);
+    }
+
+    // meta events and channel events in the order they were delivered
+    struct Order : public MidiEventSink {
+        std::string log;
+        virtual void events(const MidiRtEvent*, size_t count)
+        {
+            log.append(count, 'n');
+        }
+    };
+
+    void metaCallback(void* userData, const MidiMetaEvent*)
+    {
+        ((Order*) userData)->log += 'm';
+    }
+
+    void testCallback()
+    {
+        MidiSong song;
+        buildMarked(song);
+        MidiSongPlayer player(&song);
+        Order order;
+        player.addSink(&order);
+        CHECK(player.setMetaCallback(metaCallback, &order));
+
+        // the meta events due in an update come before its channel events
+        player.updateNs(15 * ms);
+        CHECK(order.log == "mmmn");
+
+        // and they are delivered while muted, after the note off muting
+        // sends for the sounding note
+        CHECK(player.setMute(true));
+        player.updateNs(35 * ms);
+        CHECK(order.log == "mmmnnmmm");
+
+        CHECK(player.setMetaCallback(nullptr, nullptr));
+        player.updateNs(45 * ms);
+        CHECK(order.log == "mmmnnmmm");
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testTimeline();
+    testLookups();
+    testCallback();
+    return finish();
+}
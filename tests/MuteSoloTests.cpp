@@ -0,0 +1,108 @@
+//
+//  MuteSoloTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiSongPlayer's track and channel mute and solo, which take
+// effect at the next update, and never cut off a sounding note's note off.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    const int64_t ms = 1000000;
+
+    // Track t plays on channel t: a note from 0 to 50 milliseconds, and a
+    // control change every 10 milliseconds in between
+    void buildTracks(MidiSong& song)
+    {
+        std::vector<Track> tracks;
+        for (uint8_t t = 0; t < 3; ++t) {
+            Track track = { { 0, { uint8_t(MIDI_NOTE_ON | t), uint8_t(60 + t), 100 } } };
+            for (int i = 1; i < 5; ++i)
+                track.push_back(TimedBytes{ i * 10, { uint8_t(MIDI_CONTROL_CHANGE | t), 7, uint8_t(i) } });
+            track.push_back(TimedBytes{ 50, { uint8_t(MIDI_NOTE_OFF | t), uint8_t(60 + t), 0 } });
+            tracks.push_back(track);
+        }
+        buildSong(song, tracks);
+    }
+
+    // the channels of the events dispatched by an update
+    std::vector<int> channels(MidiSongPlayer& player, EventLog& log, int64_t time)
+    {
+        log.clear();
+        player.updateNs(time);
+        std::vector<int> c;
+        for (const MidiRtEvent& ev : log.received)
+            c.push_back(ev.command.command & 0x0f);
+        return c;
+    }
+
+    void testMasks()
+    {
+        MidiSong song;
+        buildTracks(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+
+        CHECK(channels(player, log, 0) == std::vector<int>({ 0, 1, 2 }));
+
+        player.setTrackMute(1, true);
+        CHECK(channels(player, log, 10 * ms) == std::vector<int>({ 0, 2 }));
+
+        player.setTrackSolo(2, true);
+        CHECK(channels(player, log, 20 * ms) == std::vector<int>({ 2 }));
+
+        // soloing a channel and a track admits both, but mute wins
+        player.setChannelSolo(0, true);
+        player.setTrackSolo(1, true);
+        CHECK(channels(player, log, 30 * ms) == std::vector<int>({ 0, 2 }));
+
+        player.setTrackMute(1, false);
+        player.setTrackSolo(1, false);
+        player.setTrackSolo(2, false);
+        player.setChannelSolo(0, false);
+        player.setChannelMute(2, true);
+        CHECK(channels(player, log, 40 * ms) == std::vector<int>({ 0, 1 }));
+
+        // the muted channel's note is still sounding, so its note off
+        // goes through
+        CHECK(channels(player, log, 50 * ms) == std::vector<int>({ 0, 1, 2 }));
+        CHECK(log.received.back().command.command == (MIDI_NOTE_OFF | 2));
+    }
+
+    void testMutedNoteStaysSilent()
+    {
+        MidiSong song;
+        buildTracks(song);
+        MidiSongPlayer player(&song);
+        EventLog log;
+        player.addSink(&log);
+
+        // a note that never sounded has no note off to send
+        player.setChannelMute(1, true);
+        CHECK(channels(player, log, 0) == std::vector<int>({ 0, 2 }));
+        player.setChannelMute(1, false);
+        player.setChannelMute(2, true);
+        player.setChannelSolo(2, true);
+        CHECK(channels(player, log, 10 * ms).empty());
+        player.setChannelMute(1, true);
+        player.setChannelSolo(2, false);
+        CHECK(channels(player, log, 50 * ms) == std::vector<int>({ 0, 0, 0, 0, 2 }));
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testMasks();
+    testMutedNoteStaysSilent();
+    return finish();
+}
@@ -0,0 +1,146 @@
+//
+//  PacingTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiOut's pacing, which holds messages back to the rate a DIN
+// wire carries them: the rate itself, turning pacing off with messages
+// waiting, clearing the schedule without leaving notes hanging, and that
+// the output thread sleeps while a backlog waits for the wire.
+
+#include "LabMidiTest.h"
+#include <chrono>
+#include <ctime>
+#include <thread>
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    // Reads until count messages have arrived, or a wait times out
+    std::vector<Bytes> receive(MidiIn& in, size_t count, int64_t timeoutNs,
+                               std::vector<int64_t>* arrival = nullptr)
+    {
+        std::vector<Bytes> received;
+        MidiInMessage msg;
+        while (received.size() < count && in.wait(msg, timeoutNs)) {
+            received.push_back(Bytes(msg.data, msg.data + msg.size));
+            if (arrival)
+                arrival->push_back(msg.arrivalNs);
+        }
+        return received;
+    }
+
+    void testRate()
+    {
+        MidiIn in;
+        in.enableQueue(256, 1024);
+        MidiOut out;
+        CHECK(out.openLoopbackPort(&in));
+        out.setPacing(MidiOut::kDinBytesPerSecond);
+
+        // three bytes at 320 microseconds a byte, apart from the first few,
+        // which fit in the backlog the interface is assumed to buffer
+        const int count = 30;
+        for (int i = 0; i < count; ++i)
+            out.sendNoteOn(0, i, 100);
+        std::vector<int64_t> arrival;
+        CHECK(receive(in, count, 1000000000, &arrival).size() == count);
+        if (arrival.size() == count)
+            CHECK(arrival.back() - arrival.front() >= (count - 4) * 3 * 320000);
+        MidiOutPacingStats stats = out.pacingStats();
+        CHECK(stats.messages == count);
+        CHECK(stats.delayed > 0);
+        CHECK(stats.dropped == 0);
+    }
+
+    void testPacingOff()
+    {
+        MidiIn in;
+        in.enableQueue(256, 1024);
+        MidiOut out;
+        CHECK(out.openLoopbackPort(&in));
+
+        // at ten bytes a second, the first message goes at once, and holds
+        // the wire for three tenths of a second
+        out.setPacing(10);
+        for (int i = 0; i < 5; ++i)
+            out.sendControlChange(0, 1, i);
+        CHECK(receive(in, 1, 1000000000).size() == 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        // turning pacing off sends the rest without waiting for the wire
+        int64_t start = monotonicNanoseconds();
+        out.setPacing(0);
+        CHECK(receive(in, 4, 100000000).size() == 4);
+        CHECK(monotonicNanoseconds() - start < 100000000);
+    }
+
+    void testClearKeepsNoteOffs()
+    {
+        MidiIn in;
+        in.enableQueue(256, 1024);
+        MidiOut out;
+        CHECK(out.openLoopbackPort(&in));
+
+        out.setPacing(10);
+        out.sendNoteOn(0, 60, 100);
+        out.sendNoteOn(0, 61, 100);            // waiting for the wire
+        out.sendNoteOff(0, 60, 0);             // waiting for the wire
+        CHECK(receive(in, 1, 1000000000).size() == 1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+        // a note off due far in the future is sent when cleared, and the
+        // note on scheduled with it is not
+        int64_t later = monotonicNanoseconds() + 10000000000;
+        CHECK(out.sendAt(later, MidiCommand(MIDI_NOTE_ON, 62, 100)));
+        CHECK(out.sendAt(later, MidiCommand(MIDI_NOTE_OFF, 62, 0)));
+        out.clearScheduled();
+        out.setPacing(0);
+
+        std::vector<Bytes> expected = {
+            { MIDI_NOTE_OFF, 60, 0 },
+            { MIDI_NOTE_OFF, 62, 0 },
+        };
+        CHECK(receive(in, 3, 100000000) == expected);
+    }
+
+    void testBacklogSleeps()
+    {
+        MidiIn in;
+        in.enableQueue(256, 1024);
+        MidiOut out;
+        CHECK(out.openLoopbackPort(&in));
+        out.setPacing(10);
+
+        // more messages due than the waiting room holds, so some that are
+        // due wait in the schedule for room
+        int64_t now = monotonicNanoseconds();
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 4000; ++i)
+                out.sendAt(now, MidiCommand(MIDI_CONTROL_CHANGE, 1, uint8_t(i & 0x7f)));
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+
+        std::clock_t cpu = std::clock();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        double busy = double(std::clock() - cpu) / CLOCKS_PER_SEC;
+        CHECK(busy < 0.05);
+        out.clearScheduled();
+        out.setPacing(0);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testRate();
+    testPacingOff();
+    testClearKeepsNoteOffs();
+    testBacklogSleeps();
+    return finish();
+}
@@ -0,0 +1,110 @@
+//
+//  RcuListTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of RcuList, the list behind MidiIn's and MidiSongPlayer's
+// callbacks and sinks: that retired snapshots are freed while reads are in
+// progress, and that synchronize() waits for other threads' reads but not
+// for the caller's own.
+
+#include "LabMidiTest.h"
+#include "LabMidiRcu.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    // counts the copies of itself held by every snapshot
+    struct Item {
+        static inline std::atomic<int> live { 0 };
+        Item() { ++live; }
+        Item(const Item&) { ++live; }
+        ~Item() { --live; }
+    };
+
+    bool any(const Item&) { return true; }
+
+    void testReclaimWhileReading()
+    {
+        RcuList<Item> list;
+        list.add(Item());
+        {
+            // a read that outlasts every write mustn't keep the other
+            // retired snapshots alive
+            RcuList<Item>::Reader r(list);
+            for (int i = 0; i < 1000; ++i) {
+                list.add(Item());
+                list.removeIf(any);
+            }
+            CHECK(r.size() == 1);
+            CHECK(Item::live == 1);
+        }
+        list.add(Item());
+        CHECK(Item::live == 1);
+    }
+
+    void testSynchronizeWaits()
+    {
+        RcuList<Item> list;
+        list.add(Item());
+        std::atomic<bool> holding { false };
+        std::atomic<bool> release { false };
+        std::thread reader([&]() {
+            RcuList<Item>::Reader r(list);
+            holding.store(true);
+            while (!release.load())
+                std::this_thread::yield();
+        });
+        while (!holding.load())
+            std::this_thread::yield();
+
+        list.removeIf(any);
+        std::atomic<bool> done { false };
+        std::thread writer([&]() {
+            list.synchronize();
+            done.store(true);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK(!done.load());
+        release.store(true);
+        reader.join();
+        writer.join();
+        CHECK(done.load());
+    }
+
+    void testSynchronizeOwnReads()
+    {
+        RcuList<Item> a;
+        RcuList<Item> b;
+        a.add(Item());
+        b.add(Item());
+
+        // reads of a and then b are in progress on this thread, so it
+        // mustn't wait for either
+        RcuList<Item>::Reader ra(a);
+        RcuList<Item>::Reader rb(b);
+        RcuList<Item>::Reader ra2(a);
+        a.removeIf(any);
+        a.synchronize();
+        b.removeIf(any);
+        b.synchronize();
+        CHECK(ra.size() == 1 && rb.size() == 1 && ra2.size() == 1);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testReclaimWhileReading();
+    testSynchronizeWaits();
+    testSynchronizeOwnReads();
+    return finish();
+}
@@ -0,0 +1,87 @@
+//
+//  RecorderTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks that MidiRecorder captures what arrives while recording, and that
+// the song it builds survives being written and parsed again.
+
+#include "LabMidiTest.h"
+#include <sstream>
+#include <string>
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    void testRecorderRoundTrip()
+    {
+        MidiIn in;
+        MidiRecorder recorder;
+        recorder.attach(&in);
+        MidiLoopbackOut out(&in);
+
+        MidiCommand ignored(MIDI_NOTE_ON, 1, 1);
+        out.command(&ignored);                 // not recording yet
+
+        recorder.start();
+        MidiCommand on(MIDI_NOTE_ON, 60, 100);
+        MidiCommand cc(MIDI_CONTROL_CHANGE | 1, 7, 90);
+        MidiCommand clock(MIDI_TIME_CLOCK, 0, 0);
+        MidiCommand off(MIDI_NOTE_OFF, 60, 0);
+        Bytes dump = sysex(20, 5);
+        out.command(&on);
+        out.command(&cc);
+        out.command(&clock);                   // realtime isn't recorded
+        out.send(dump.data(), dump.size());
+        out.command(&off);
+        recorder.stop();
+        out.command(&ignored);
+        CHECK(recorder.messageCount() == 4);
+        CHECK(recorder.droppedCount() == 0);
+
+        MidiSong song;
+        recorder.buildSong(song, 120, 480);
+        std::ostringstream file;
+        song.writeMidi(file);
+        std::string bytes = file.str();
+
+        MidiSong parsed;
+        parsed.parse((const uint8_t*) bytes.data(), bytes.size(), false);
+        CHECK(parsed.ticksPerBeat == 480);
+
+        // the conductor track with the SysEx, then channels 1 and 2
+        CHECK(parsed.tracks.size() == 3);
+        std::vector<Bytes> channel;
+        std::vector<Bytes> system;
+        for (auto& track : parsed.tracks)
+            for (MidiEvent* ev : track->events) {
+                if (ev->eventType == Midi_MetaEventType::LABMIDI_CHANNEL_EVENT)
+                    channel.push_back(ev->data);
+                else if (ev->eventType == Midi_MetaEventType::SYSTEM_EXCLUSIVE)
+                    system.push_back(ev->data);
+            }
+        std::vector<Bytes> expected = {
+            { MIDI_NOTE_ON, 60, 100 },
+            { MIDI_NOTE_OFF, 60, 0 },
+            { MIDI_CONTROL_CHANGE | 1, 7, 90 },
+        };
+        CHECK(channel == expected);
+        CHECK(system.size() == 1 && system[0] == Bytes(dump.begin() + 1, dump.end()));
+
+        recorder.detach(&in);
+        out.command(&on);
+        CHECK(recorder.messageCount() == 4);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testRecorderRoundTrip();
+    return finish();
+}
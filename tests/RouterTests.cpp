@@ -0,0 +1,152 @@
+//
+//  RouterTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiRouter: routing by track and by channel, moving events to
+// another channel, order at each destination, and counting the events a
+// full destination drops.
+
+#include "LabMidiTest.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    // keeps what it is sent, optionally holding up its worker until opened
+    struct Destination : public MidiOutBase {
+        std::mutex mutex;
+        std::vector<Bytes> sent;
+        std::atomic<bool> open { true };
+
+        virtual void command(const MidiCommand* mc)
+        {
+            while (!open.load())
+                std::this_thread::yield();
+            std::lock_guard<std::mutex> lock(mutex);
+            sent.push_back({ mc->command, mc->byte1, mc->byte2 });
+        }
+
+        std::vector<Bytes> take()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<Bytes> s;
+            s.swap(sent);
+            return s;
+        }
+    };
+
+    MidiRtEvent event(uint8_t track, uint8_t command, uint8_t byte1, uint8_t byte2 = 0)
+    {
+        return MidiRtEvent(0, command, byte1, byte2, track);
+    }
+
+    void testRoutes()
+    {
+        MidiRouter router;
+        Destination a;
+        Destination b;
+        CHECK(router.addDestination(&a) == 0);
+        CHECK(router.addDestination(&b) == 1);
+        CHECK(router.destinationCount() == 2);
+
+        CHECK(router.routeTrack(0, 0));
+        CHECK(router.routeChannel(1, 1, 5));
+        CHECK(!router.routeTrack(-1, 0));
+        CHECK(!router.routeTrack(0, 2));
+        CHECK(!router.routeChannel(16, 0));
+        CHECK(!router.routeChannel(0, 0, 16));
+
+        MidiRtEvent ev[] = {
+            event(0, MIDI_NOTE_ON, 60, 100),        // to a
+            event(2, MIDI_NOTE_ON | 1, 61, 100),    // to b, on channel 5
+            event(0, MIDI_NOTE_ON | 1, 62, 100),    // to both
+            event(3, MIDI_NOTE_ON | 2, 63, 100),    // nowhere
+            event(0, MIDI_TIME_CLOCK, 0),           // to a, not a channel message
+        };
+        router.events(ev, sizeof(ev) / sizeof(ev[0]));
+        router.flush();
+        std::vector<Bytes> toA = {
+            { MIDI_NOTE_ON, 60, 100 },
+            { MIDI_NOTE_ON | 1, 62, 100 },
+            { MIDI_TIME_CLOCK, 0, 0 },
+        };
+        std::vector<Bytes> toB = {
+            { MIDI_NOTE_ON | 5, 61, 100 },
+            { MIDI_NOTE_ON | 5, 62, 100 },
+        };
+        CHECK(a.take() == toA);
+        CHECK(b.take() == toB);
+
+        router.clearRoutes();
+        router.events(ev, sizeof(ev) / sizeof(ev[0]));
+        router.flush();
+        CHECK(a.take().empty() && b.take().empty());
+        CHECK(router.droppedCount(0) == 0 && router.droppedCount(1) == 0);
+    }
+
+    void testOrder()
+    {
+        MidiRouter router;
+        Destination a;
+        router.addDestination(&a);
+        router.routeChannel(0, 0);
+
+        std::vector<Bytes> expected;
+        for (int batch = 0; batch < 10; ++batch) {
+            MidiRtEvent ev[100];
+            for (int i = 0; i < 100; ++i) {
+                ev[i] = event(0, MIDI_CONTROL_CHANGE, uint8_t(batch), uint8_t(i));
+                expected.push_back({ MIDI_CONTROL_CHANGE, uint8_t(batch), uint8_t(i) });
+            }
+            router.events(ev, 100);
+        }
+        router.flush();
+        CHECK(a.take() == expected);
+        CHECK(router.droppedCount(0) == 0);
+    }
+
+    void testDropped()
+    {
+        // a stalled destination drops what its queue can't hold, without
+        // holding up the others
+        MidiRouter router(8);
+        Destination slow;
+        Destination fast;
+        slow.open.store(false);
+        router.addDestination(&slow);
+        router.addDestination(&fast);
+        router.routeChannel(0, 0);
+        router.routeChannel(0, 1);
+
+        size_t received = 0;
+        for (int i = 0; i < 32; ++i) {
+            MidiRtEvent ev = event(0, MIDI_CONTROL_CHANGE, 1, uint8_t(i));
+            router.events(&ev, 1);
+            while (received <= size_t(i))
+                received += fast.take().size();
+        }
+        CHECK(router.droppedCount(0) > 0);
+
+        slow.open.store(true);
+        router.flush();
+        CHECK(slow.take().size() + router.droppedCount(0) == 32);
+        CHECK(router.droppedCount(1) == 0);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testRoutes();
+    testOrder();
+    testDropped();
+    return finish();
+}
@@ -0,0 +1,69 @@
+//
+//  ScheduledSendTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks that MidiOut::sendAt delivers messages in time order, messages
+// due together in the order they were scheduled, and none of them early.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    void testSendAtOrder()
+    {
+        MidiIn in;
+        in.enableQueue(64, 1024);
+        MidiOut out;
+        CHECK(out.openLoopbackPort(&in));
+
+        // scheduled out of order, in pairs due at the same time, after a
+        // message far in the future, which mustn't hold up the rest
+        int64_t start = monotonicNanoseconds();
+        int64_t origin = start + 20000000;
+        const int count = 20;
+        int64_t due[count];
+        CHECK(out.sendAt(start + 10000000000, MidiCommand(MIDI_NOTE_ON, 127, 1)));
+        for (int i = 0; i < count; ++i) {
+            due[i] = origin + ((count - 1 - i) / 2) * 1000000;
+            CHECK(out.sendAt(due[i], MidiCommand(MIDI_NOTE_ON, uint8_t(i), 1)));
+        }
+        CHECK(out.sendAt(start - 1, MidiCommand(MIDI_CONTROL_CHANGE, 1, 1)));
+
+        std::vector<Bytes> received;
+        std::vector<int64_t> arrival;
+        MidiInMessage msg;
+        while (received.size() < count + 1 && in.wait(msg, 2000000000)) {
+            received.push_back(Bytes(msg.data, msg.data + msg.size));
+            arrival.push_back(msg.arrivalNs);
+        }
+        out.clearScheduled();
+
+        // the message already due goes first, then by time, and messages
+        // due together in the order they were scheduled
+        std::vector<Bytes> expected = { { MIDI_CONTROL_CHANGE, 1, 1 } };
+        for (int t = 0; t <= (count - 1) / 2; ++t)
+            for (int i = 0; i < count; ++i)
+                if ((count - 1 - i) / 2 == t)
+                    expected.push_back({ MIDI_NOTE_ON, uint8_t(i), 1 });
+        CHECK(received == expected);
+
+        // nothing is sent early
+        if (received == expected)
+            for (size_t i = 1; i < received.size(); ++i)
+                CHECK(arrival[i] >= due[received[i][1]]);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testSendAtOrder();
+    return finish();
+}
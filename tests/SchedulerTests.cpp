@@ -0,0 +1,122 @@
+//
+//  SchedulerTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks that MidiScheduler dispatches the events of many players in time
+// order, applies adds and removes at the next update, and reports its
+// player count to other threads.
+
+#include "LabMidiTest.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    // records the note number of each event, which the songs set to the
+    // event's time in milliseconds
+    struct Log : public MidiEventSink {
+        std::vector<int> notes;
+        virtual void events(const MidiRtEvent* ev, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                notes.push_back(ev[i].command.byte1);
+        }
+    };
+
+    void buildNotes(MidiSong& song, int first, int step, int count)
+    {
+        Track track;
+        for (int i = 0; i < count; ++i) {
+            int ms = first + i * step;
+            track.push_back(TimedBytes{ ms, { MIDI_NOTE_ON, uint8_t(ms), 100 } });
+        }
+        buildSong(song, { track });
+    }
+
+    void testOrder()
+    {
+        MidiSong a;
+        MidiSong b;
+        buildNotes(a, 0, 10, 5);
+        buildNotes(b, 5, 10, 5);
+        MidiSongPlayer pa(&a);
+        MidiSongPlayer pb(&b);
+        Log log;
+        pa.addSink(&log);
+        pb.addSink(&log);
+
+        MidiScheduler scheduler(16);
+        CHECK(scheduler.add(&pa));
+        CHECK(scheduler.add(&pb));
+        CHECK(!scheduler.settled());
+        CHECK(scheduler.playerCount() == 0);
+        scheduler.updateNs(0);
+        CHECK(scheduler.settled());
+        CHECK(scheduler.playerCount() == 2);
+        CHECK(scheduler.nextEventTimeNs() == 5000000);
+
+        // one update interleaves the players' events
+        scheduler.updateNs(22000000);
+        CHECK(log.notes == std::vector<int>({ 0, 5, 10, 15, 20 }));
+
+        // a removed player's events stop at the next update
+        CHECK(scheduler.remove(&pb));
+        CHECK(!scheduler.settled());
+        scheduler.updateNs(100000000);
+        CHECK(scheduler.settled());
+        CHECK(scheduler.playerCount() == 1);
+        CHECK(log.notes == std::vector<int>({ 0, 5, 10, 15, 20, 30, 40 }));
+        CHECK(scheduler.nextEventTimeNs() == INT64_MAX);
+    }
+
+    void testCountFromControlThread()
+    {
+        MidiSong song;
+        buildNotes(song, 0, 10, 10);
+        const size_t count = 100;
+        std::vector<std::unique_ptr<MidiSongPlayer>> players;
+        for (size_t i = 0; i < count; ++i)
+            players.emplace_back(new MidiSongPlayer(&song));
+
+        MidiScheduler scheduler(count);
+        std::atomic<bool> quit { false };
+        std::thread driver([&]() {
+            while (!quit.load())
+                scheduler.updateNs(0);
+        });
+
+        auto waitFor = [&](size_t n) {
+            auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while ((scheduler.playerCount() != n || !scheduler.settled()) &&
+                   std::chrono::steady_clock::now() < until)
+                std::this_thread::yield();
+            return scheduler.playerCount() == n;
+        };
+        for (auto& p : players)
+            CHECK(scheduler.add(p.get()));
+        CHECK(waitFor(count));
+        for (auto& p : players)
+            CHECK(scheduler.remove(p.get()));
+        CHECK(waitFor(0));
+
+        quit.store(true);
+        driver.join();
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testOrder();
+    testCountFromControlThread();
+    return finish();
+}
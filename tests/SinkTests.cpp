@@ -0,0 +1,87 @@
+//
+//  SinkTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks that MidiIn hands its sinks the messages taken by dispatch in
+// batches, one call per batch, after the callbacks for them.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    struct Log : public MidiEventSink {
+        std::vector<size_t> calls;              // the count of each call
+        std::vector<MidiCommand> commands;
+        int callbacksBefore = -1;               // callbacks seen by the first call
+        int callbacks = 0;
+
+        virtual void events(const MidiRtEvent* ev, size_t count)
+        {
+            if (calls.empty())
+                callbacksBefore = callbacks;
+            calls.push_back(count);
+            for (size_t i = 0; i < count; ++i)
+                commands.push_back(ev[i].command);
+        }
+    };
+
+    void countCallback(void* userData, MidiCommand*)
+    {
+        ++((Log*) userData)->callbacks;
+    }
+
+    void testDispatchBatches()
+    {
+        MidiIn in;
+        in.enableQueue(256, 1024);
+        Log log;
+        in.addSink(&log);
+        in.addCallback(countCallback, &log);
+        MidiLoopbackOut out(&in);
+
+        const int count = 100;
+        for (int i = 0; i < count; ++i) {
+            MidiCommand mc(MIDI_NOTE_ON, uint8_t(i), 100);
+            out.command(&mc);
+        }
+        CHECK(in.dispatch() == count);
+        CHECK(log.calls == std::vector<size_t>({ 64, count - 64 }));
+        CHECK(log.callbacksBefore == 64);
+        CHECK(log.commands.size() == count);
+        bool inOrder = log.commands.size() == count;
+        for (size_t i = 0; inOrder && i < log.commands.size(); ++i)
+            inOrder = log.commands[i].command == MIDI_NOTE_ON && log.commands[i].byte1 == i;
+        CHECK(inOrder);
+        in.removeSink(&log);
+        in.removeCallback(&log);
+    }
+
+    void testDirect()
+    {
+        // delivered as they arrive, messages come one at a time
+        MidiIn in;
+        Log log;
+        in.addSink(&log);
+        MidiLoopbackOut out(&in);
+        for (int i = 0; i < 3; ++i) {
+            MidiCommand mc(MIDI_CONTROL_CHANGE, 7, uint8_t(i));
+            out.command(&mc);
+        }
+        CHECK(log.calls == std::vector<size_t>({ 1, 1, 1 }));
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testDispatchBatches();
+    testDirect();
+    return finish();
+}
@@ -0,0 +1,72 @@
+//
+//  SysExTests.cpp
+//
+
+//  Copyright (c) 2012, Nick Porcino
+//  All rights reserved.
+//  SPDX-License-Identifier: BSD-2-Clause
+
+// Checks of MidiOut::sendSysEx: that a dump is split into its messages,
+// and that on a paced port each message holds the modelled wire for its
+// length, so that what is sent after it waits its turn.
+
+#include "LabMidiTest.h"
+
+using namespace Lab;
+using namespace LabMidiTest;
+
+namespace {
+
+    void testSplit()
+    {
+        MidiIn in;
+        in.enableQueue(64, 4096);
+        MidiOut out;
+        CHECK(out.openLoopbackPort(&in));
+
+        Bytes a = sysex(10, 1);
+        Bytes b = sysex(300, 2);
+        Bytes dump = a;
+        dump.insert(dump.end(), b.begin(), b.end());
+        dump.push_back(0x42);                  // outside a message
+        CHECK(!out.sendSysEx(dump.data(), dump.size()));
+        std::vector<Bytes> expected = { a, b };
+        CHECK(readAll(in) == expected);
+    }
+
+    void testPaced()
+    {
+        MidiIn in;
+        in.enableQueue(64, 4096);
+        MidiOut out;
+        CHECK(out.openLoopbackPort(&in));
+        out.setPacing(MidiOut::kDinBytesPerSecond);
+
+        // a hundred bytes hold the wire for 32 milliseconds, so the next
+        // message, SysEx or not, waits for nearly that long
+        Bytes one = sysex(100, 3);
+        Bytes dump = one;
+        dump.insert(dump.end(), one.begin(), one.end());
+        CHECK(out.sendSysEx(dump.data(), dump.size()));
+        out.sendNoteOn(0, 60, 100);
+
+        std::vector<int64_t> arrival;
+        MidiInMessage msg;
+        while (arrival.size() < 3 && in.wait(msg, 1000000000))
+            arrival.push_back(msg.arrivalNs);
+        CHECK(arrival.size() == 3);
+        if (arrival.size() == 3) {
+            CHECK(arrival[1] - arrival[0] >= 28000000);
+            CHECK(arrival[2] - arrival[1] >= 28000000);
+        }
+        CHECK(out.pacingStats().delayed == 1);
+    }
+
+} // anon
+
+int main(int, char**)
+{
+    testSplit();
+    testPaced();
+    return finish();
+}